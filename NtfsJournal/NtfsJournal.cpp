@@ -32,6 +32,7 @@
 #include <iomanip>
 #include <math.h>
 #include <set>
+#include <vector>
 #include <functional>       // for std::hash
 
 #include "winerrhandlers.h"
@@ -42,6 +43,8 @@ using namespace WinErrHandlers;
 #include "localefmt.h"
 
 #include "ntfsutil.h"   // namespace Ntfs_Journal
+#include "SysShim.h"    // namespace SysShim
+#include "UsnGenerator.h"
 
 #define _VERSION "v3.03"
 
@@ -56,11 +59,25 @@ char sUsage[] =
     "  Use 'fsutil usn ...' to create and configure NTFS journal.\n"
     "Use:\n"
     "   NtfsJournal [options] <localNTFSdrive>... \n"
+    "   NtfsJournal [options] -j <usnJrnlFile>... \n"
+    "   NtfsJournal [options] -i <ntfsImageFile>... \n"
+    "   NtfsJournal [options] -c <captureFile>... \n"
     " Filter (see examples below):\n"
     "   -a [d|f]                  ; Just Directories or Files, default is both \n"
+    "   -c <captureFile>          ; Replay journal capture written with -w\n"
     "   -d                        ; Show detail, by default remove duplicates\n"
     "   -f <findFilter>           ; Filter by file path, use * or ? patterns \n"
     "   -g <findFilter>           ; Filter by file path, using grep reqular Expression ^[]+*.$ \n"
+    "   -i <ntfsImageFile>        ; Read journal from raw NTFS volume image (dd)\n"
+    "   -j <usnJrnlFile>          ; Read extracted $Extend\\$UsnJrnl:$J file instead of drive\n"
+    "                             ; Offline (-c,-i,-j) records only report file name, unless -m or -P\n"
+    "   -k <cacheDir>             ; Keep directory path cache of each drive between runs in cacheDir\n"
+    "                             ; Reused while journal is unchanged, use with -u - for fast repeated scans\n"
+    "                             ; Not used with -P\n"
+    "   -m <mftFile>              ; Resolve paths and sizes from extracted $MFT file or raw image\n"
+    "                             ; of the scanned volume, loaded once before the scan, one journal only\n"
+    "   -o                        ; Merge output of all journals ordered by time\n"
+    "                             ; Journals (drives and files) are always scanned in parallel\n"
     "   -p                        ; Skip finding full path, much faster results\n"
     "   -r <changeReasonFilter>   ; Filter by change flags \n"
     "   -s <size>                 ; Filter by file size  \n"
@@ -68,15 +85,28 @@ char sUsage[] =
     "   -u <usn>                  ; Start scan with usn number, see -U\n"
     "   -u -                      ; Start with previously stored USN in registry\n"
     "                             ; On exit, last USN is automatically stored in registry\n"
+    "   -w <captureFile>          ; Capture raw journal records read to file, see -c\n"
+    " Benchmark (drive system calls):\n"
+    "   -b <KB>                   ; Drive journal read size 64 to 4096, default grows from 64KB to 4MB\n"
+    "   -x <shimFile>             ; Record volume ioctls and file id lookups to file\n"
+    "   -X <shimFile>             ; Replay recorded calls instead of accessing drive\n"
+    "   -L <microseconds>         ; Latency added to every replayed call\n"
+    "   -G <usnJrnlFile>          ; Generate synthetic $J journal file, read it with -j\n"
+    "   -n <records>              ; Number of records to generate, default 1000000\n"
+    "   -V <2|3>                  ; Generate USN_RECORD_V2 or V3, default 2\n"
     " Report (what appears in output):\n"
     "   -A                        ; Include attributes \n"
     "   -B <dirAttr>              ; Change directory attribute 'D' to some other string \n"
     "   -C <fmtChar>              ; Change format character '%' to some other character \n"
     "   -D                        ; Disable directory \n"
+    "   -E <8|16>                 ; Encode redirected output as UTF-8 or UTF-16LE, default 8\n"
     "   -F <fmt>                  ; Format output, %t=time, %s=size, %r=reason,%a=attribute \n"
     "                             ; %p=path(dir+filename), %c=drive, %d=directory,\n"
     "                             ; %f=filename (name+ext), %n=name, %e=extension\n"
+    "                             ; %x=changed byte ranges offset+length;... (range tracking)\n"
     "                             ; Field can be padded, as in %10s %15t %20f\n"
+    "   -P                        ; Path from journal records, fast, works offline and for deleted files\n"
+    "                             ; Directories older than journal are looked up on drive, or shown as \\#<fileId>\n"
     "   -R [a|l]                  ; Include Reasons, All or just Last, default is just Last\n"
     "   -S                        ; Include size \n"
     "   -T                        ; Include modify time \n"
@@ -92,6 +122,14 @@ char sUsage[] =
     "    c:                 ; scan c drive, display filenames. \n"
     "    -TSA c:            ; scan c drive, display  time, size, attributes. \n"
     "    -p c:              ; fast scan c drive, just filenames, not full path. \n"
+    "    -j d:\\dumps\\host1_J  ; scan journal extracted from another host. \n"
+    "    -i d:\\dumps\\host1.dd ; scan journal inside raw volume image. \n"
+    "    -o c: d: e:        ; scan c, d and e drives in parallel, output ordered by time. \n"
+    "    -w c.cap c:        ; scan c drive and capture its journal, replay with -c c.cap \n"
+    "    -k c:\\cache -u - c: ; scan c drive changes since last run, paths cached between runs. \n"
+    "    -G gen_J -n 50000000 -j gen_J ; generate 50M record journal and scan it. \n"
+    "    -P -j d:\\dumps\\host1_J ; scan extracted journal, paths rebuilt from its records. \n"
+    "    -m d:\\dumps\\host1_MFT -j d:\\dumps\\host1_J ; scan extracted journal, paths from $MFT. \n"
     "  Filter examples (precede 'f' command letter with ! to invert rule):\n"
     "    -f *.txt d:        ; files ending in .txt on d: drive \n"
     "    -!f *.txt d:       ; files NOT ending in .txt on d: drive \n" 
@@ -147,14 +185,22 @@ int wmain(int argc, const wchar_t* argv[])
 
     bool loadUsnFromReg = false;
     bool matchOn = true;
+    bool timeOrder = false;
     ReportCfg cfg;
-    Ntfs ntfs;
+    Ntfs_Journal::SessionList sessions;
+    std::vector<const wchar_t*> journalFiles;
+    std::vector<const wchar_t*> imageFiles;
+    std::vector<const wchar_t*> captureFiles;
+    const wchar_t* shimRecordFile = NULL;
+    const wchar_t* shimReplayFile = NULL;
+    const wchar_t* generateFile = NULL;
+    UsnGenerator generator;
 
     // dateFmt(L"dd-MMM-yyyy"), timeFmt(L"HH:mm"),
     Ntfs_Journal::ReadRegistry(L"TimeFormat", cfg.timeFmt);
     Ntfs_Journal::ReadRegistry(L"DateFormat", cfg.dateFmt);
 
-    GetOpts<wchar_t> getOpts(argc, argv, L",!a:df:g:pr:s:t:u:AB:C:DF:R:STU?");
+    GetOpts<wchar_t> getOpts(argc, argv, L",!a:b:c:df:g:i:j:k:m:n:opr:s:t:u:w:x:AB:C:DE:F:G:L:PR:STUV:X:?");
     const wchar_t* pArg;
 
     while (getOpts.GetOpt())
@@ -176,6 +222,26 @@ int wmain(int argc, const wchar_t* argv[])
                 cfg.showFilter = ReportCfg::eShowFile;
             break;
 
+        case 'b':   // drive journal read size in KB
+            {
+                // A capture replay rejects batches larger than the largest read.
+                wchar_t* endPtr;
+                unsigned long readKB = wcstoul(getOpts.OptArg(), &endPtr, 10);
+                if (endPtr == getOpts.OptArg() || *endPtr != '\0'
+                    || readKB < VolumeSource::sMinReadSize / 1024 || readKB > VolumeSource::sMaxReadSize / 1024)
+                {
+                    std::wcerr << "Invalid read size argument:" << getOpts.OptArg() << ", expect "
+                        << VolumeSource::sMinReadSize / 1024 << " to " << VolumeSource::sMaxReadSize / 1024 << " KB\n";
+                    return -1;
+                }
+                cfg.readSize = (DWORD)readKB * 1024;
+            }
+            break;
+
+        case 'c':   // replay journal capture
+            captureFiles.push_back(getOpts.OptArg());
+            break;
+
         case 'd':   // show detail
             cfg.showDetail = true;
             break;
@@ -186,7 +252,31 @@ int wmain(int argc, const wchar_t* argv[])
 
         case 'g':   // grep (regular expression) file filter
             pArg = getOpts.OptArg();
-            cfg.filter.List().push_back(new MatchName(std::wregex(pArg, std::regex::icase), IsGrepIcase, matchOn));
+            cfg.filter.List().push_back(new MatchName(std::wregex(pArg, std::regex::icase), IsGrepIcase, matchOn, pArg));
+            break;
+
+        case 'i':   // raw NTFS volume image
+            imageFiles.push_back(getOpts.OptArg());
+            break;
+
+        case 'j':   // extracted $UsnJrnl:$J file
+            journalFiles.push_back(getOpts.OptArg());
+            break;
+
+        case 'k':   // keep path cache between runs
+            cfg.pathCacheDir = getOpts.OptArg();
+            break;
+
+        case 'm':   // $MFT path table
+            cfg.mftFile = getOpts.OptArg();
+            break;
+
+        case 'n':   // generated record count
+            generator.SetRecordCount(_wcstoui64(getOpts.OptArg(), NULL, 10));
+            break;
+
+        case 'o':   // merge output by time
+            timeOrder = true;
             break;
 
         case 'p':
@@ -208,7 +298,6 @@ int wmain(int argc, const wchar_t* argv[])
                 }
                 cfg.filter.List().push_back(new MatchSize(labs(fileSize), fileSize > 0 ? IsSizeGreater : IsSizeLess, matchOn));
             }
-            cfg.getFileLength = true;
             matchOn = true;
             break;
 
@@ -240,6 +329,30 @@ int wmain(int argc, const wchar_t* argv[])
             }
             break;
 
+        case 'w':   // capture raw journal batches
+            cfg.captureFile = getOpts.OptArg();
+            break;
+
+        case 'x':   // record system calls
+            shimRecordFile = getOpts.OptArg();
+            break;
+
+        case 'G':   // generate synthetic journal
+            generateFile = getOpts.OptArg();
+            break;
+
+        case 'L':   // replay latency
+            SysShim::SetLatency(wcstoul(getOpts.OptArg(), NULL, 10));
+            break;
+
+        case 'V':   // generated record version
+            generator.SetMajorVersion((WORD)wcstoul(getOpts.OptArg(), NULL, 10));
+            break;
+
+        case 'X':   // replay system calls
+            shimReplayFile = getOpts.OptArg();
+            break;
+
         case 'A':   // attributes
             cfg.attribute = !cfg.attribute;
             break;
@@ -252,9 +365,16 @@ int wmain(int argc, const wchar_t* argv[])
         case 'D':   // directory path
             cfg.directory = !cfg.directory;
             break;
+        case 'E':   // output encoding, 8 or 16
+            cfg.outputUtf16 = (wcstoul(getOpts.OptArg(), NULL, 10) == 16);
+            break;
         case 'F':   // output format
             cfg.outputFmt = getOpts.OptArg();
             break;
+        case 'P':   // path from journal records
+            cfg.journalTree = true;
+            cfg.getFullPath = true;
+            break;
         case 'R':   // Include Reason in report, -R or -Ra or -Rl
             cfg.reason = !cfg.reason;
             cfg.reasonMergeAll = false;
@@ -269,7 +389,6 @@ int wmain(int argc, const wchar_t* argv[])
             break;
         case 'S':   // size
             cfg.size = !cfg.size;
-            cfg.getFileLength = true;
             break;     
         case 'U':   // usn
             cfg.usn = !cfg.usn;
@@ -285,11 +404,39 @@ int wmain(int argc, const wchar_t* argv[])
         }
     }
 
-    DWORD error = 0;
+    std::wstring shimError;
+    if (shimReplayFile != NULL && !SysShim::Replay(shimReplayFile, shimError))
+    {
+        std::wcerr << "Failed to load call recording:" << shimReplayFile << "\nError:" << shimError << std::endl;
+        return -1;
+    }
+    if (shimRecordFile != NULL && !SysShim::Record(shimRecordFile, shimError))
+    {
+        std::wcerr << "Failed to create call recording:" << shimRecordFile << "\nError:" << shimError << std::endl;
+        return -1;
+    }
+
+    if (generateFile != NULL)
+    {
+        std::wcerr << L"--- Generate journal " << generateFile << std::endl;
+
+        DWORD tick = GetTickCount();
+        if (!generator.Generate(generateFile))
+        {
+            std::wcerr << "Failed to generate journal:" << generateFile << "\nError:" << generator.GetLastErrorMsg() << std::endl;
+            return -1;
+        }
+
+        wchar_t str[30];
+        std::wcerr << L"--- Wrote " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", generator.GetBytesWritten())
+            << L" bytes in " << (GetTickCount() - tick)/1000.0 << L" seconds\n";
+    }
+
+    // One session per journal, each with its own report settings (drive pattern filter and start usn).
     if (getOpts.NextIdx() < argc)
     {
         int addedFilter = -1;
-        for (int optIdx = getOpts.NextIdx(); error == 0 && optIdx < argc; optIdx++)
+        for (int optIdx = getOpts.NextIdx(); optIdx < argc; optIdx++)
         {
             const wchar_t* arg = argv[optIdx];
             if (wcslen(arg) > 2)
@@ -306,24 +453,52 @@ int wmain(int argc, const wchar_t* argv[])
                 cfg.filter.List().push_back(new MatchName(arg+off, IsNameIcase, matchOn));
             }
 
+            // Saved position belongs to this drive only, not to later drives or journal files.
+            ReportCfg driveCfg = cfg;
             if (loadUsnFromReg)
-                Ntfs_Journal::ReadRegistry(arg[0], cfg.startUsn);
+                Ntfs_Journal::ReadRegistry(arg[0], driveCfg.startUsn);
 
-            std::wcerr << L"--- Journal for " << arg << std::endl;
+            sessions.push_back(new Ntfs_Journal::JournalSession(Ntfs_Journal::JournalSession::eDrive, arg, driveCfg));
+        }
+    }
 
-            DWORD tick = GetTickCount();
-            error |= Ntfs_Journal::ListJournal(arg, ntfs, cfg);
-            std::wcerr << L"--- " << (GetTickCount() - tick)/1000.0 << L" seconds\n";
+    for (unsigned fileIdx = 0; fileIdx < journalFiles.size(); fileIdx++)
+        sessions.push_back(new Ntfs_Journal::JournalSession(Ntfs_Journal::JournalSession::eJournalFile, journalFiles[fileIdx], cfg));
+    for (unsigned imageIdx = 0; imageIdx < imageFiles.size(); imageIdx++)
+        sessions.push_back(new Ntfs_Journal::JournalSession(Ntfs_Journal::JournalSession::eImage, imageFiles[imageIdx], cfg));
+    for (unsigned captureIdx = 0; captureIdx < captureFiles.size(); captureIdx++)
+        sessions.push_back(new Ntfs_Journal::JournalSession(Ntfs_Journal::JournalSession::eCapture, captureFiles[captureIdx], cfg));
 
-            std::wcout << std::endl;
-        }
+    int error = 0;
+    if (cfg.captureFile != NULL && sessions.size() > 1)
+    {
+        std::wcerr << "Capture (-w) supports only one journal, found " << sessions.size() << std::endl;
+        error = -1;
+    }
+    else if (cfg.mftFile != NULL && sessions.size() > 1)
+    {
+        // Path table describes one volume, other journals would get its paths.
+        std::wcerr << "$MFT (-m) supports only one journal, found " << sessions.size() << std::endl;
+        error = -1;
+    }
+    else if (!sessions.empty())
+    {
+        error = Ntfs_Journal::RunSessions(sessions, timeOrder);
     }
 
-    if (ntfs.IsOpen() && ntfs.GetNextUsn() != 0)
+    for (unsigned sessionIdx = 0; sessionIdx < sessions.size(); sessionIdx++)
     {
-        Ntfs_Journal::WriteRegistry(ntfs.GetDrive(), ntfs.GetNextUsn());
+        // Replayed journal position does not belong to this machine.
+        Ntfs_Journal::JournalSession* pSession = sessions[sessionIdx];
+        if (pSession->IsOpen() && pSession->GetNextUsn() != 0 && SysShim::GetMode() != SysShim::eReplay)
+        {
+            Ntfs_Journal::WriteRegistry(pSession->GetDrive(), pSession->GetNextUsn());
+        }
+        delete pSession;
     }
 
+    SysShim::Close();
+
 	return error;
 }
 
@@ -70,6 +70,81 @@ bool IsName(const std::wstring& name, const std::wstring& pattern)
 }
 
 
+// ------------------------------------------------------------------------------------------------
+// Wildcard pattern *tail, where tail has no * or slash, matches a path exactly when it
+// matches the path's file name. A ? in tail could also match the slash before a short name.
+
+LeafType GetLeafType(const std::wstring& pattern, size_t& leafLength)
+{
+    if (pattern.length() < 2 || pattern[0] != '*')
+        return eLeafNone;
+
+    std::wstring tail = pattern.substr(1);
+    if (tail.find_first_of(L"*\\") != std::wstring::npos)
+        return eLeafNone;
+
+    leafLength = tail.length();
+    return (tail.find('?') == std::wstring::npos) ? eLeafExact : eLeafShort;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Regular expression .*tail is anchored on both ends (regex_match). If tail has no slash,
+// no . wildcard, no repeat and no negated set, it can only match within the file name.
+// A set holding a range or a class ([A-z], [[:punct:]]) may match a slash, so it is not one.
+// Alternation must be inside a group, else it would not be preceded by .*
+
+LeafType GetGrepLeafType(const std::wstring& regText)
+{
+    if (regText.length() < 3 || regText.compare(0, 2, L".*") != 0)
+        return eLeafNone;
+
+    int depth = 0;
+    bool inSet = false;
+    for (size_t idx = 2; idx < regText.length(); idx++)
+    {
+        wchar_t chr = regText[idx];
+        if (chr == '\\')
+            return eLeafNone;
+
+        if (inSet)
+        {
+            if (chr == '-' || chr == '[')
+                return eLeafNone;
+            if (chr == ']')
+                inSet = false;
+            continue;
+        }
+
+        switch (chr)
+        {
+        case '[':
+            if (idx + 1 < regText.length() && regText[idx + 1] == '^')
+                return eLeafNone;
+            inSet = true;
+            break;
+        case '(':
+            depth++;
+            break;
+        case ')':
+            depth--;
+            break;
+        case '|':
+            if (depth <= 0)
+                return eLeafNone;
+            break;
+        case '.':
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+        case '^':
+            return eLeafNone;
+        }
+    }
+
+    return (depth == 0 && !inSet) ? eLeafExact : eLeafNone;
+}
+
 // ------------------------------------------------------------------------------------------------
 
 bool IsGrepIcase(const std::wstring& name, const std::wregex& regPattern)
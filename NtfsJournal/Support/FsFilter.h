@@ -27,6 +27,19 @@ public:
 
     virtual bool IsMatch(const dataType& data, const void* pData) = 0;
 
+    // True if test needs resolved path or length, such tests run after path lookup.
+    virtual bool NeedsPath() const
+    { return true; }
+
+    // True if test needs file length, which is only looked up when something needs it.
+    virtual bool NeedsLength() const
+    { return false; }
+
+    // Test of raw record before path lookup, name is file name only.
+    // Return false only if IsMatch is sure to fail once path is resolved.
+    virtual bool IsRawMatch(const dataType& data, const void* pData)
+    { return NeedsPath() || IsMatch(data, pData); }
+
     bool m_matchOn;
 };
 
@@ -109,6 +122,16 @@ public:
         return true;
     }
 
+    bool IsRawMatch(const dataType& data, const void* pData) const
+    {
+        for (unsigned mIdx = 0; mIdx < m_testList.size(); mIdx++)
+        {
+            if (!m_testList[mIdx]->IsRawMatch(data, pData))
+                return false;
+        }
+        return true;
+    }
+
     virtual bool IsValid() const
     { return m_testList.size() != 0; }
 
@@ -146,6 +169,9 @@ public:
         return m_test(jRecord.m_timestamp, m_fileTime) == m_matchOn;
     }
 
+    virtual bool NeedsPath() const
+    { return false; }
+
     FILETIME m_fileTime;
     Test     m_test;
 };
@@ -158,6 +184,16 @@ extern bool IsName(const std::wstring&, const std::wstring& namePattern);
 
 extern bool IsGrepIcase(const std::wstring&, const std::wregex& namePattern);   // Ignore case
                
+// How much of a name pattern can be decided from file name alone (see GetLeafType).
+enum LeafType
+{
+    eLeafNone,      // pattern needs full path
+    eLeafExact,     // matches full path exactly when it matches file name
+    eLeafShort      // as exact, if file name is at least m_leafLength long
+};
+extern LeafType GetLeafType(const std::wstring& namePattern, size_t& leafLength);
+extern LeafType GetGrepLeafType(const std::wstring& regText);
+
 // ------------------------------------------------------------------------------------------------
 class MatchName : public Match<JRecord>
 {
@@ -167,23 +203,52 @@ public:
 
     MatchName(const std::wstring& name, PatTest patTest = IsNameIcase, bool matchOn = true) :
         Match(matchOn),
-        m_type(ePattern), m_name(name), m_patTest(patTest)
-    { }
+        m_type(ePattern), m_name(name), m_patTest(patTest),
+        m_leafLength(0)
+    { m_leafType = GetLeafType(name, m_leafLength); }
 
-    MatchName(const std::wregex& regPat, RegTest regTest = IsGrepIcase, bool matchOn = true) :
+    // regText is source of regPat, used to check if expression can match file name alone.
+    MatchName(const std::wregex& regPat, RegTest regTest = IsGrepIcase, bool matchOn = true,
+            const std::wstring& regText = L"") :
         Match(matchOn),
-        m_type(eRegExp), m_regPat(regPat), m_regTest(regTest)
+        m_type(eRegExp), m_regPat(regPat), m_regTest(regTest),
+        m_leafType(GetGrepLeafType(regText)), m_leafLength(0)
     { }
 
     virtual bool IsMatch(const JRecord& jRecord, const void* pData)
+    {
+        return IsNameMatch(jRecord.m_filename) == m_matchOn;
+    }
+
+    virtual bool NeedsPath() const
+    { return m_leafType != eLeafExact; }
+
+    // Pattern which starts with * (or .*) and has no slash after it can only match the file
+    // name at end of path, and never a directory path which ends in slash.
+    virtual bool IsRawMatch(const JRecord& jRecord, const void* pData)
+    {
+        const std::wstring& name = jRecord.m_filename;
+        bool isDir = (jRecord.m_fileAttr & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        if (m_leafType == eLeafNone || name.empty() || (isDir && m_leafType != eLeafExact))
+            return true;
+        if (isDir)
+            return !m_matchOn;
+
+        bool isMatch = IsNameMatch(name);
+        if (!isMatch && m_leafType == eLeafShort && name.length() < m_leafLength)
+            return true;
+        return isMatch == m_matchOn;
+    }
+
+    bool IsNameMatch(const std::wstring& name) const
     {
         switch (m_type)
         {
         default:
         case ePattern:
-            return (m_patTest(jRecord.m_filename, m_name)) == m_matchOn;
+            return m_patTest(name, m_name);
         case eRegExp:
-            return (m_regTest(jRecord.m_filename, m_regPat)) == m_matchOn;
+            return m_regTest(name, m_regPat);
         }
     }
 
@@ -195,6 +260,9 @@ public:
 
     std::wregex  m_regPat;
     RegTest      m_regTest;
+
+    LeafType     m_leafType;
+    size_t       m_leafLength;   // characters pattern matches after its leading *
 };
 
 
@@ -222,6 +290,9 @@ public:
         return m_test(jRecord.m_length.QuadPart, m_size) == m_matchOn;
     }
 
+    virtual bool NeedsLength() const
+    { return true; }
+
     LONGLONG     m_size;
     Test         m_test;
 };
@@ -51,6 +51,16 @@ namespace WinErrHandlers {
         LocalFree(lpMsgBuf);
         return msg;
     }
+
+    // Error number and its string, as saved by the Ntfs classes for GetLastErrorMsg.
+    std::wstring LastErrorMsg(unsigned int error) {
+        if (error == 0)
+            error = GetLastError();
+
+        wchar_t msg[30];
+        wsprintf(msg, TEXT("[0x%x]"), error);
+        return msg + ErrorMsg(error);
+    }
 }
 
 
@@ -35,6 +35,8 @@
 
 namespace WinErrHandlers { 
    std::wstring ErrorMsg(unsigned int error);
+   // "[0x<error>]" followed by ErrorMsg, error 0 uses GetLastError().
+   std::wstring LastErrorMsg(unsigned int error = 0);
 
    void InitUnhandledExceptionFilter();
 };
@@ -0,0 +1,47 @@
+// ------------------------------------------------------------------------------------------------
+// File reference number (file id) key type.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <Windows.h>
+#include <string.h>
+
+// ------------------------------------------------------------------------------------------------
+// File reference number, 64 bit NTFS id (USN_RECORD_V2) or 128 bit id (V3/V4, ReFS).
+// NTFS ids reported as FILE_ID_128 keep the 64 bit id in the low half, so both compare equal.
+struct FileRef
+{
+    ULONGLONG   low;
+    ULONGLONG   high;
+
+    FileRef(ULONGLONG id = 0) : low(id), high(0)
+    { }
+
+    FileRef(const FILE_ID_128& id)
+    {
+        memcpy(&low, id.Identifier, sizeof(low));
+        memcpy(&high, id.Identifier + sizeof(low), sizeof(high));
+    }
+
+    bool Is64() const
+    { return high == 0; }
+
+    bool operator==(const FileRef& other) const
+    { return low == other.low && high == other.high; }
+    bool operator!=(const FileRef& other) const
+    { return !(*this == other); }
+    bool operator<(const FileRef& other) const
+    { return high < other.high || (high == other.high && low < other.low); }
+};
+
+// ------------------------------------------------------------------------------------------------
+// Hash for unordered containers keyed by FileRef.
+struct FileRefHash
+{
+    size_t operator()(const FileRef& ref) const
+    {
+        ULONGLONG key = ref.low ^ (ref.high * 0x9e3779b97f4a7c15ULL);
+        return (size_t)(key ^ (key >> 29));
+    }
+};
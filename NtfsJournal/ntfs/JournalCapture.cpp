@@ -0,0 +1,223 @@
+// ------------------------------------------------------------------------------------------------
+// Journal capture, record raw batches of any journal source to a file and replay them later.
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+
+#include "JournalCapture.h"
+
+static const char sCaptureMagic[8] = { 'N', 'T', 'J', 'C', 'A', 'P', 'T', 0 };
+static const DWORD sCaptureVersion = 1;
+
+// No source hands out larger batches, a larger length is a damaged capture.
+static const DWORD sMaxBatchLength = VolumeSource::sMaxReadSize;
+
+// ------------------------------------------------------------------------------------------------
+CaptureRecorder::CaptureRecorder(JournalSource& source) :
+    m_source(source)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+CaptureRecorder::~CaptureRecorder()
+{
+    Close();
+}
+
+// ------------------------------------------------------------------------------------------------
+bool CaptureRecorder::Open(const wchar_t* capturePath)
+{
+    m_fileHnd = CreateFile(capturePath, GENERIC_WRITE,
+        FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (!m_fileHnd.IsValid())
+    {
+        SaveLastError();
+        return false;
+    }
+
+    CaptureFileHeader header;
+    ZeroMemory(&header, sizeof(header));
+    memcpy(header.magic, sCaptureMagic, sizeof(header.magic));
+    header.version = sCaptureVersion;
+    return Write(&header, sizeof(header));
+}
+
+// ------------------------------------------------------------------------------------------------
+void CaptureRecorder::Close()
+{
+    m_fileHnd = INVALID_HANDLE_VALUE;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool CaptureRecorder::Write(const void* pData, DWORD length)
+{
+    DWORD written;
+    if (!WriteFile(m_fileHnd, pData, length, &written, NULL))
+    {
+        SaveLastError();
+        return false;
+    }
+    if (written != length)
+    {
+        SaveLastError(ERROR_DISK_FULL);
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool CaptureRecorder::Start(USN startUsn, DWORD reasonFilter)
+{
+    if (!m_source.Start(startUsn, reasonFilter))
+    {
+        m_errorMsg = m_source.GetLastErrorMsg();
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool CaptureRecorder::ReadBatch(JournalBatch& batch)
+{
+    if (!m_source.ReadBatch(batch))
+    {
+        if (!m_source.HasFailed())
+            return false;
+        m_errorMsg = m_source.GetLastErrorMsg();
+        return ReadFailed();
+    }
+
+    m_bytesRead    = m_source.GetBytesRead();
+    m_skippedBytes = m_source.GetSkippedBytes();
+    m_batchCount   = m_source.GetBatchCount();
+
+    if (!m_fileHnd.IsValid())
+        return true;
+
+    CaptureBatchHeader header;
+    header.length    = batch.length;
+    header.isStream  = batch.isStream ? 1 : 0;
+    header.streamUsn = batch.streamUsn;
+    header.nextUsn   = batch.nextUsn;
+    if (!Write(&header, sizeof(header)) || !Write(batch.pData, batch.length))
+        return ReadFailed();
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+CaptureSource::CaptureSource() :
+    m_fileSize(0),
+    m_filePos(0),
+    m_startUsn(0)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+CaptureSource::~CaptureSource()
+{
+    Close();
+}
+
+// ------------------------------------------------------------------------------------------------
+bool CaptureSource::Open(const wchar_t* capturePath)
+{
+    m_fileHnd = CreateFile(capturePath, GENERIC_READ,
+        FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (!m_fileHnd.IsValid())
+    {
+        SaveLastError();
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void CaptureSource::Close()
+{
+    m_fileHnd = INVALID_HANDLE_VALUE;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool CaptureSource::Read(void* pData, DWORD length)
+{
+    DWORD bytesRead;
+    if (!ReadFile(m_fileHnd, pData, length, &bytesRead, NULL))
+    {
+        SaveLastError();
+        return false;
+    }
+    m_filePos += bytesRead;
+    if (bytesRead != length)
+    {
+        SaveErrorMsg(L"Journal capture file is truncated");
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool CaptureSource::Start(USN startUsn, DWORD)
+{
+    if (!IsOpen())
+        return false;
+
+    LARGE_INTEGER zero;
+    zero.QuadPart = 0;
+    LARGE_INTEGER fileSize;
+    CaptureFileHeader header;
+    m_filePos = 0;
+    if (!GetFileSizeEx(m_fileHnd, &fileSize) || !SetFilePointerEx(m_fileHnd, zero, NULL, FILE_BEGIN))
+    {
+        SaveLastError();
+        return false;
+    }
+    m_fileSize = (ULONGLONG)fileSize.QuadPart;
+    if (!Read(&header, sizeof(header)))
+        return false;
+
+    if (memcmp(header.magic, sCaptureMagic, sizeof(header.magic)) != 0
+        || header.version != sCaptureVersion)
+    {
+        SaveErrorMsg(L"Not a journal capture file");
+        return false;
+    }
+
+    m_startUsn = startUsn;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return next captured batch, batches which end before the start USN are passed over.
+// Capture ends cleanly on a batch boundary, anything else is a truncated or damaged file.
+bool CaptureSource::ReadBatch(JournalBatch& batch)
+{
+    CaptureBatchHeader header;
+    do
+    {
+        if (m_filePos == m_fileSize)
+            return false;
+        if (!Read(&header, sizeof(header)))
+            return ReadFailed();
+
+        if (header.length > sMaxBatchLength || header.length > m_fileSize - m_filePos)
+        {
+            SaveErrorMsg(L"Journal capture batch length is damaged");
+            return ReadFailed();
+        }
+
+        m_buffer.resize(header.length + 1);
+        if (!Read(&m_buffer[0], header.length))
+            return ReadFailed();
+
+        m_bytesRead += sizeof(header) + header.length;
+    } while (m_startUsn != 0 && header.nextUsn <= m_startUsn);
+
+    m_batchCount++;
+
+    batch.pData     = &m_buffer[0];
+    batch.length    = header.length;
+    batch.isStream  = (header.isStream != 0);
+    batch.streamUsn = header.streamUsn;
+    batch.nextUsn   = header.nextUsn;
+    return true;
+}
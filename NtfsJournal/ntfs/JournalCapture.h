@@ -0,0 +1,73 @@
+// ------------------------------------------------------------------------------------------------
+// Journal capture, record raw batches of any journal source to a file and replay them later.
+// Replay feeds the same decoder as the original source, without the volume or image.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "JournalSource.h"
+
+// Capture file layout, all batches follow the file header.
+struct CaptureFileHeader
+{
+    char            magic[8];       // sCaptureMagic
+    DWORD           version;
+    DWORD           reserved;
+};
+
+struct CaptureBatchHeader
+{
+    DWORD           length;         // bytes of records which follow
+    DWORD           isStream;
+    ULONGLONG       streamUsn;
+    USN             nextUsn;
+};
+
+// ------------------------------------------------------------------------------------------------
+// Pass batches of another source through unchanged, writing each one to capture file.
+class CaptureRecorder : public JournalSource
+{
+public:
+    CaptureRecorder(JournalSource& source);
+    ~CaptureRecorder();
+
+    bool Open(const wchar_t* capturePath);
+    void Close();
+
+    virtual bool Start(USN startUsn, DWORD reasonFilter);
+    virtual bool ReadBatch(JournalBatch& batch);
+    virtual bool IsVolume() const
+    { return m_source.IsVolume(); }
+
+private:
+    bool Write(const void* pData, DWORD length);
+
+    JournalSource&          m_source;
+    Hnd                     m_fileHnd;
+};
+
+// ------------------------------------------------------------------------------------------------
+// Replay capture file written by CaptureRecorder.
+class CaptureSource : public JournalSource
+{
+public:
+    CaptureSource();
+    ~CaptureSource();
+
+    bool Open(const wchar_t* capturePath);
+    void Close();
+    bool IsOpen() const
+    { return m_fileHnd.IsValid(); }
+
+    virtual bool Start(USN startUsn, DWORD reasonFilter);
+    virtual bool ReadBatch(JournalBatch& batch);
+
+private:
+    bool Read(void* pData, DWORD length);
+
+    Hnd                     m_fileHnd;
+    ULONGLONG               m_fileSize;
+    ULONGLONG               m_filePos;
+    std::vector<BYTE>       m_buffer;
+    USN                     m_startUsn;
+};
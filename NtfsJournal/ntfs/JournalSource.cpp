@@ -0,0 +1,248 @@
+// ------------------------------------------------------------------------------------------------
+// Journal source interface, separates journal I/O from record decoding.
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+#include <stddef.h>
+
+#include "JournalSource.h"
+#include "SysShim.h"
+#include "winerrhandlers.h"
+
+// ------------------------------------------------------------------------------------------------
+void JournalSource::SaveLastError(DWORD error) const
+{
+    m_errorMsg = WinErrHandlers::LastErrorMsg(error);
+}
+
+// ------------------------------------------------------------------------------------------------
+bool JournalSource::IsValidRecord(const USN_RECORD_COMMON_HEADER* pRecord, ULONGLONG usn, ULONGLONG avail)
+{
+    if (avail < sizeof(USN_RECORD_COMMON_HEADER)
+        || pRecord->RecordLength > avail
+        || pRecord->RecordLength > sPageSize
+        || (pRecord->RecordLength & 7) != 0)
+        return false;
+
+    // In a $J stream the USN of a record is its byte offset.
+    switch (pRecord->MajorVersion)
+    {
+    case 2:
+        {
+        const USN_RECORD_V2* pV2 = (const USN_RECORD_V2*)pRecord;
+        return pRecord->RecordLength >= offsetof(USN_RECORD_V2, FileName)
+            && (ULONGLONG)pV2->Usn == usn
+            && (DWORD)pV2->FileNameOffset + pV2->FileNameLength <= pRecord->RecordLength;
+        }
+    case 3:
+        {
+        const USN_RECORD_V3* pV3 = (const USN_RECORD_V3*)pRecord;
+        return pRecord->RecordLength >= offsetof(USN_RECORD_V3, FileName)
+            && (ULONGLONG)pV3->Usn == usn
+            && (DWORD)pV3->FileNameOffset + pV3->FileNameLength <= pRecord->RecordLength;
+        }
+    case 4:
+        {
+        const USN_RECORD_V4* pV4 = (const USN_RECORD_V4*)pRecord;
+        return pRecord->RecordLength >= offsetof(USN_RECORD_V4, Extents)
+            && (ULONGLONG)pV4->Usn == usn
+            && pV4->ExtentSize >= sizeof(USN_RECORD_EXTENT)
+            && offsetof(USN_RECORD_V4, Extents) + (DWORD)pV4->NumberOfExtents * pV4->ExtentSize <= pRecord->RecordLength;
+        }
+    }
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+USN JournalSource::GetRecordUsn(const USN_RECORD_COMMON_HEADER* pRecord)
+{
+    switch (pRecord->MajorVersion)
+    {
+    case 2: return ((const USN_RECORD_V2*)pRecord)->Usn;
+    case 3: return ((const USN_RECORD_V3*)pRecord)->Usn;
+    case 4: return ((const USN_RECORD_V4*)pRecord)->Usn;
+    }
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+DWORD JournalSource::GetRecordReason(const USN_RECORD_COMMON_HEADER* pRecord)
+{
+    switch (pRecord->MajorVersion)
+    {
+    case 2: return ((const USN_RECORD_V2*)pRecord)->Reason;
+    case 3: return ((const USN_RECORD_V3*)pRecord)->Reason;
+    case 4: return ((const USN_RECORD_V4*)pRecord)->Reason;
+    }
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+FileRef JournalSource::GetRecordFileRef(const USN_RECORD_COMMON_HEADER* pRecord)
+{
+    switch (pRecord->MajorVersion)
+    {
+    case 2: return FileRef(((const USN_RECORD_V2*)pRecord)->FileReferenceNumber);
+    case 3: return FileRef(((const USN_RECORD_V3*)pRecord)->FileReferenceNumber);
+    case 4: return FileRef(((const USN_RECORD_V4*)pRecord)->FileReferenceNumber);
+    }
+    return FileRef();
+}
+
+// ------------------------------------------------------------------------------------------------
+FileRef JournalSource::GetRecordParentRef(const USN_RECORD_COMMON_HEADER* pRecord)
+{
+    switch (pRecord->MajorVersion)
+    {
+    case 2: return FileRef(((const USN_RECORD_V2*)pRecord)->ParentFileReferenceNumber);
+    case 3: return FileRef(((const USN_RECORD_V3*)pRecord)->ParentFileReferenceNumber);
+    case 4: return FileRef(((const USN_RECORD_V4*)pRecord)->ParentFileReferenceNumber);
+    }
+    return FileRef();
+}
+
+// ------------------------------------------------------------------------------------------------
+DWORD JournalSource::GetRecordAttributes(const USN_RECORD_COMMON_HEADER* pRecord)
+{
+    switch (pRecord->MajorVersion)
+    {
+    case 2: return ((const USN_RECORD_V2*)pRecord)->FileAttributes;
+    case 3: return ((const USN_RECORD_V3*)pRecord)->FileAttributes;
+    }
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+VolumeSource::VolumeSource(HANDLE volHnd, DWORD readSize) :
+    m_volHnd(volHnd),
+    m_readSize(readSize == sAutoReadSize ? sMinReadSize : readSize),
+    m_maxReadSize(readSize == sAutoReadSize ? sMaxReadSize : readSize),
+    m_ring(sRingSize)
+{
+    ZeroMemory(&m_journalData, sizeof(m_journalData));
+    ZeroMemory(&m_readData, sizeof(m_readData));
+    m_ring.Close();
+}
+
+// ------------------------------------------------------------------------------------------------
+VolumeSource::~VolumeSource()
+{
+    Stop();
+}
+
+// ------------------------------------------------------------------------------------------------
+void VolumeSource::Stop()
+{
+    m_ring.Close();
+    if (m_reader.joinable())
+        m_reader.join();
+}
+
+// ------------------------------------------------------------------------------------------------
+bool VolumeSource::Start(USN startUsn, DWORD reasonFilter)
+{
+    Stop();
+
+    DWORD cb;
+    if (!SysShim::DeviceIoControl(m_volHnd, FSCTL_QUERY_USN_JOURNAL, NULL, 0,
+            &m_journalData, sizeof(m_journalData), &cb))
+    {
+        SaveLastError();
+        return false;
+    }
+
+    /*
+    *      READ_USN_JOURNAL_DATA
+                USN StartUsn;
+                DWORD ReasonMask;
+                DWORD ReturnOnlyOnClose;
+                DWORDLONG Timeout;
+                DWORDLONG BytesToWaitFor;
+                DWORDLONG UsnJournalID;
+                WORD   MinMajorVersion;
+                WORD   MaxMajorVersion;
+    */
+    ZeroMemory(&m_readData, sizeof(m_readData));
+    m_readData.StartUsn        = (startUsn == 0) ? m_journalData.FirstUsn : startUsn;
+    m_readData.ReasonMask      = reasonFilter;
+    m_readData.UsnJournalID    = m_journalData.UsnJournalID;
+    m_readData.BytesToWaitFor  = 0;
+
+    // V3 carries 128 bit file ids (ReFS), V4 byte ranges when range tracking is enabled.
+    m_readData.MinMajorVersion = 2;
+    m_readData.MaxMajorVersion = m_journalData.MaxSupportedMajorVersion;
+    if (m_readData.MaxMajorVersion < 2)
+        m_readData.MaxMajorVersion = 2;
+    else if (m_readData.MaxMajorVersion > 4)
+        m_readData.MaxMajorVersion = 4;
+
+    m_ring.Reset();
+    m_reader = std::thread(&VolumeSource::ReadLoop, this);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reader thread, queue batches until journal end, error or Stop.
+void VolumeSource::ReadLoop()
+{
+    ReadBuffer buffer;
+    while (!m_ring.IsClosed())
+    {
+        if (buffer.data.size() != m_readSize)
+            buffer.data.resize(m_readSize);
+
+        // Get some records from the journal
+        DWORD bytesRead;
+        BOOL retval = SysShim::DeviceIoControl(m_volHnd, FSCTL_READ_USN_JOURNAL, &m_readData, sizeof(m_readData),
+                &buffer.data[0], (DWORD)buffer.data.size(), &bytesRead);
+
+        // Replayed reads come back whole, a smaller read than recorded asks for more room.
+        if (!retval && GetLastError() == ERROR_INSUFFICIENT_BUFFER && m_readSize < sMaxReadSize)
+        {
+            m_readSize = m_maxReadSize = sMaxReadSize;
+            continue;
+        }
+
+        // We are finished if DeviceIoControl fails, or the number of bytes
+        // returned is < sizeof(USN). Failure is seen by decoder once ring is closed.
+        if (!retval)
+        {
+            SaveLastError();
+            ReadFailed();
+            break;
+        }
+        if (bytesRead <= sizeof(USN))
+            break;
+
+        // Output starts with USN to resume reading, records follow.
+        buffer.bytesRead = bytesRead;
+        m_readData.StartUsn = *(USN*)&buffer.data[0];
+
+        // Records never span a page, so a read within a page of full means more are waiting.
+        if (bytesRead + sPageSize > buffer.data.size() && m_readSize < m_maxReadSize)
+            m_readSize = min(m_readSize * 2, m_maxReadSize);
+
+        // Waits while decoder is behind, gets back a buffer it finished with.
+        if (!m_ring.Push(buffer))
+            break;
+    }
+    m_ring.Close();
+}
+
+// ------------------------------------------------------------------------------------------------
+// Batch stays valid until next call, its buffer then goes back to the reader.
+bool VolumeSource::ReadBatch(JournalBatch& batch)
+{
+    if (!m_ring.Pop(m_current))
+        return false;
+
+    m_bytesRead += m_current.bytesRead;
+    m_batchCount++;
+
+    batch.pData     = &m_current.data[0] + sizeof(USN);
+    batch.length    = m_current.bytesRead - sizeof(USN);
+    batch.isStream  = false;
+    batch.streamUsn = 0;
+    batch.nextUsn   = *(const USN*)&m_current.data[0];
+    return true;
+}
@@ -0,0 +1,149 @@
+// ------------------------------------------------------------------------------------------------
+// Journal source interface, separates journal I/O from record decoding.
+// Sources hand out batches of raw USN records which Ntfs decodes, resolves and reports.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Hnd.h"
+#include "FileRef.h"
+#include "SpscRing.h"
+
+using namespace std;
+
+// ------------------------------------------------------------------------------------------------
+// Raw USN records, memory is owned by the source and valid until its next ReadBatch.
+struct JournalBatch
+{
+    const BYTE*     pData;          // first record
+    DWORD           length;         // bytes of records
+    bool            isStream;       // true if $J stream layout, record USN is its stream offset
+                                    // and pages may be zero padded.
+    ULONGLONG       streamUsn;      // stream offset of pData if isStream
+    USN             nextUsn;        // USN to resume reading after this batch
+};
+
+// ------------------------------------------------------------------------------------------------
+class JournalSource
+{
+public:
+    JournalSource() :
+        m_bytesRead(0), m_skippedBytes(0), m_batchCount(0), m_readFailed(false)
+    { }
+
+    virtual ~JournalSource()
+    { }
+
+    // Position source at startUsn, zero starts with oldest available record.
+    // Sources which can filter by reason themselves (live journal) use reasonFilter.
+    virtual bool Start(USN startUsn, DWORD reasonFilter) = 0;
+
+    // Get next batch of records, return false when no more records or on error.
+    virtual bool ReadBatch(JournalBatch& batch) = 0;
+
+    // True if ReadBatch stopped on an error rather than at end of journal, see GetLastErrorMsg.
+    bool HasFailed() const
+    { return m_readFailed; }
+
+    // True if records come from the live volume, so paths can be resolved by file id.
+    virtual bool IsVolume() const
+    { return false; }
+
+    wstring GetLastErrorMsg() const
+    { return m_errorMsg; }
+
+    // Notice about journal layout found while reading (damaged data worked around), or empty.
+    wstring GetNoteMsg() const
+    { return m_noteMsg; }
+
+    // I/O statistics.
+    ULONGLONG GetBytesRead() const
+    { return m_bytesRead; }
+    ULONGLONG GetSkippedBytes() const       // sparse (zero filled) journal not walked.
+    { return m_skippedBytes; }
+    ULONGLONG GetBatchCount() const
+    { return m_batchCount; }
+
+    // USN records never span a journal page, remainder of page is zero filled.
+    static const unsigned sPageSize = 4096;
+
+    // Return true if record (V2, V3 or V4) at 'usn' looks valid, 'avail' is bytes readable at pRecord.
+    static bool IsValidRecord(const USN_RECORD_COMMON_HEADER* pRecord, ULONGLONG usn, ULONGLONG avail);
+
+    // Fields common to all record versions, at version specific offsets.
+    static USN GetRecordUsn(const USN_RECORD_COMMON_HEADER* pRecord);
+    static DWORD GetRecordReason(const USN_RECORD_COMMON_HEADER* pRecord);
+    static FileRef GetRecordFileRef(const USN_RECORD_COMMON_HEADER* pRecord);
+    static FileRef GetRecordParentRef(const USN_RECORD_COMMON_HEADER* pRecord);
+    static DWORD GetRecordAttributes(const USN_RECORD_COMMON_HEADER* pRecord);     // 0 for V4
+
+protected:
+    void SaveLastError(DWORD error=0) const;
+    void SaveErrorMsg(const wchar_t* msg) const
+    { m_errorMsg = msg; }
+    // Mark ReadBatch as failed, error message is saved by caller. Returns false.
+    bool ReadFailed()
+    { m_readFailed = true; return false; }
+
+    mutable wstring         m_errorMsg;
+    wstring                 m_noteMsg;
+    ULONGLONG               m_bytesRead;
+    ULONGLONG               m_skippedBytes;
+    ULONGLONG               m_batchCount;
+    bool                    m_readFailed;
+};
+
+// ------------------------------------------------------------------------------------------------
+// Live journal on open volume, read with FSCTL_READ_USN_JOURNAL.
+// A reader thread fetches the next batches through a ring while the previous batch is
+// decoded. Read size is fixed, or starts small and doubles while reads come back full.
+class VolumeSource : public JournalSource
+{
+public:
+    VolumeSource(HANDLE volHnd, DWORD readSize = sAutoReadSize);
+    virtual ~VolumeSource();
+
+    virtual bool Start(USN startUsn, DWORD reasonFilter);
+    virtual bool ReadBatch(JournalBatch& batch);
+    virtual bool IsVolume() const
+    { return true; }
+
+    struct ReadBuffer
+    {
+        std::vector<BYTE>   data;
+        DWORD               bytesRead;
+    };
+    typedef SpscRing<ReadBuffer> ReadRing;
+
+    // Occupancy of ring between reader thread and decoder.
+    RingStats GetRingStats() const
+    { return m_ring.GetStats(); }
+    size_t GetRingCapacity() const
+    { return m_ring.GetCapacity(); }
+
+    static const DWORD sAutoReadSize = 0;
+    static const DWORD sMinReadSize = 64 * 1024;
+    static const DWORD sMaxReadSize = 4 * 1024 * 1024;
+
+private:
+    void ReadLoop();
+    void Stop();
+
+    // Reads queued ahead of decoder, besides the one being filled and the one handed out.
+    static const unsigned sRingSize = 2;
+
+    HANDLE                  m_volHnd;
+    USN_JOURNAL_DATA        m_journalData;
+    READ_USN_JOURNAL_DATA   m_readData;         // owned by reader thread once started
+    DWORD                   m_readSize;         // size of next read
+    DWORD                   m_maxReadSize;
+
+    ReadRing                m_ring;
+    ReadBuffer              m_current;          // handed out by ReadBatch
+    std::thread             m_reader;
+};
@@ -0,0 +1,105 @@
+// ------------------------------------------------------------------------------------------------
+// Directory tree rebuilt from journal records, resolves record paths in memory.
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+
+#include "JournalTree.h"
+#include "ntfstypes.h"
+
+static const wchar_t sSlash = L'\\';
+
+// ------------------------------------------------------------------------------------------------
+JournalTree::JournalTree(void)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+JournalTree::~JournalTree(void)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+void JournalTree::Clear()
+{
+    m_nodes.clear();
+}
+
+// ------------------------------------------------------------------------------------------------
+// NTFS root directory is MFT record 5, its records (if any) are never part of a path.
+bool JournalTree::IsRoot(const FileRef& fileId)
+{
+    return fileId.Is64() && (fileId.low & sMftRecordMask) == eMftRecRoot;
+}
+
+// ------------------------------------------------------------------------------------------------
+void JournalTree::Apply(const FileRef& fileId, const FileRef& parentId, const std::wstring& name)
+{
+    // Create, rename (old and new name records) and delete all carry the name and parent
+    // the file has at that point, so one update covers them all. Deleted nodes are kept,
+    // a reused MFT record gets a new sequence number and so a new file id.
+    Node& node = m_nodes[fileId];
+    node.parentId = parentId;
+    node.name = name;
+    node.isFullPath = false;
+}
+
+// ------------------------------------------------------------------------------------------------
+void JournalTree::AddDir(const FileRef& dirId, const std::wstring& fullPath)
+{
+    Node& node = m_nodes[dirId];
+    node.parentId = dirId;
+    node.name = fullPath;
+    node.isFullPath = true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool JournalTree::GetPath(const FileRef& fileId, std::wstring& path, FileRef& unknownId) const
+{
+    // Collect names leaf to root, then join them root first.
+    const std::wstring* names[sMaxDepth];
+    unsigned depth = 0;
+    bool complete = false;
+    size_t length = 0;
+
+    FileRef id = fileId;
+    while (depth < sMaxDepth)
+    {
+        if (IsRoot(id))
+        {
+            complete = true;
+            break;
+        }
+
+        NodeMap::const_iterator iter = m_nodes.find(id);
+        if (iter == m_nodes.end())
+        {
+            unknownId = id;
+            break;
+        }
+
+        const Node& node = iter->second;
+        names[depth++] = &node.name;
+        length += node.name.length() + 1;
+        if (node.isFullPath)
+        {
+            complete = true;
+            break;
+        }
+        id = node.parentId;
+    }
+
+    if (depth == sMaxDepth)
+        unknownId = id;
+
+    path.clear();
+    path.reserve(length);
+    while (depth != 0)
+    {
+        const std::wstring& name = *names[--depth];
+        if (name.empty() || name[0] != sSlash)
+            path += sSlash;
+        path += name;
+    }
+    return complete;
+}
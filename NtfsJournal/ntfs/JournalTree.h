@@ -0,0 +1,50 @@
+// ------------------------------------------------------------------------------------------------
+// Directory tree rebuilt from journal records, resolves record paths in memory.
+// Every named record carries the file id, parent id and name the file had at that USN,
+// so applying records in order (creates, renames, deletes) tracks the tree as it changes.
+// Deleted files keep their last name and parent, so their paths still resolve.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+#include "FileRef.h"
+
+class JournalTree
+{
+public:
+    JournalTree(void);
+    ~JournalTree(void);
+
+    void Clear();
+
+    // Apply named record, file is (re)named or moved to parent.
+    void Apply(const FileRef& fileId, const FileRef& parentId, const std::wstring& name);
+
+    // Add directory whose full volume path is known (looked up on volume), ends path walks.
+    void AddDir(const FileRef& dirId, const std::wstring& fullPath);
+
+    // Build path of file, return true if complete (reaches root or a looked up directory).
+    // On false, path is relative to unknownId, the first ancestor not seen in the journal.
+    bool GetPath(const FileRef& fileId, std::wstring& path, FileRef& unknownId) const;
+
+    size_t GetNodeCount() const
+    { return m_nodes.size(); }
+
+private:
+    static bool IsRoot(const FileRef& fileId);
+
+    struct Node
+    {
+        FileRef         parentId;
+        std::wstring    name;
+        bool            isFullPath;     // name is full volume path (AddDir)
+    };
+    typedef std::unordered_map<FileRef, Node, FileRefHash> NodeMap;
+
+    static const unsigned sMaxDepth = 256;  // guard against cycles in damaged journals
+
+    NodeMap     m_nodes;
+};
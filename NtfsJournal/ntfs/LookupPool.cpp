@@ -0,0 +1,135 @@
+// ------------------------------------------------------------------------------------------------
+// Worker threads which resolve a list of file ids together.
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+
+#include "LookupPool.h"
+#include "MftTable.h"
+#include "SysShim.h"
+
+static const unsigned sMaxThreads = 16;
+
+// ------------------------------------------------------------------------------------------------
+LookupPool::LookupPool(void) :
+    m_generation(0),
+    m_busy(0),
+    m_stop(false),
+    m_volHnd(INVALID_HANDLE_VALUE),
+    m_pMftTable(NULL),
+    m_pLookups(NULL),
+    m_next(0)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+LookupPool::~LookupPool(void)
+{
+    Stop();
+}
+
+// ------------------------------------------------------------------------------------------------
+void LookupPool::Start(unsigned threadCount)
+{
+    if (!m_threads.empty())
+        return;
+
+    if (threadCount == sAutoThreads)
+        threadCount = GetThreadBudget(1);
+    threadCount = min(threadCount, sMaxThreads);
+
+    m_stop = false;
+    for (unsigned idx = 0; idx < threadCount; idx++)
+        m_threads.push_back(std::thread(&LookupPool::WorkerLoop, this));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Parallel sessions each own a pool, together they keep to one less than core count.
+unsigned LookupPool::GetThreadBudget(unsigned poolCount)
+{
+    unsigned cores = std::thread::hardware_concurrency();
+    unsigned threadCount = (cores > 1) ? cores - 1 : 0;
+    return (poolCount > 1) ? threadCount / poolCount : threadCount;
+}
+
+// ------------------------------------------------------------------------------------------------
+void LookupPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_startCv.notify_all();
+
+    for (size_t idx = 0; idx < m_threads.size(); idx++)
+        m_threads[idx].join();
+    m_threads.clear();
+}
+
+// ------------------------------------------------------------------------------------------------
+// Take lookups until none are left.
+void LookupPool::RunLookups()
+{
+    LookupList& lookups = *m_pLookups;
+    for (size_t idx = m_next++; idx < lookups.size(); idx = m_next++)
+    {
+        Lookup& lookup = lookups[idx];
+        lookup.status = 0;
+        if (m_pMftTable != NULL && m_pMftTable->GetFileInfo(lookup.fileId, lookup.fullPath, lookup.allocatedSize))
+            continue;
+        lookup.status = SysShim::LookupFileId(m_volHnd, lookup.fileId, lookup.getLength,
+            lookup.fullPath, lookup.allocatedSize);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void LookupPool::WorkerLoop()
+{
+    unsigned generation = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            while (!m_stop && m_generation == generation)
+                m_startCv.wait(lock);
+            if (m_stop)
+                return;
+            generation = m_generation;
+        }
+
+        RunLookups();
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (--m_busy == 0)
+            m_doneCv.notify_all();
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void LookupPool::Resolve(HANDLE volHnd, const MftTable* pMftTable, LookupList& lookups)
+{
+    m_volHnd = volHnd;
+    m_pMftTable = pMftTable;
+    m_pLookups = &lookups;
+    m_next = 0;
+
+    // Waking workers costs more than a single lookup.
+    if (m_threads.empty() || lookups.size() < 2)
+    {
+        RunLookups();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_busy = (unsigned)m_threads.size();
+        m_generation++;
+    }
+    m_startCv.notify_all();
+
+    RunLookups();
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (m_busy != 0)
+        m_doneCv.wait(lock);
+}
@@ -0,0 +1,69 @@
+// ------------------------------------------------------------------------------------------------
+// Worker threads which resolve a list of file ids (path and optional size) together.
+// Open-by-id lookups are independent system calls, so a batch of cold directories
+// resolves in about the time of its slowest lookups instead of their sum.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FileRef.h"
+
+class MftTable;
+
+class LookupPool
+{
+public:
+    struct Lookup
+    {
+        FileRef         fileId;
+        bool            getLength;
+        DWORD           status;         // 0 if resolved, else NTSTATUS or Win32 error
+        std::wstring    fullPath;
+        LARGE_INTEGER   allocatedSize;
+    };
+    typedef std::vector<Lookup> LookupList;
+
+    LookupPool(void);
+    ~LookupPool(void);
+
+    // Start worker threads, sAutoThreads is one less than core count (caller of Resolve also works).
+    void Start(unsigned threadCount = sAutoThreads);
+    void Stop();
+
+    // Share of the cores left to each of poolCount pools running at once, may be 0.
+    static unsigned GetThreadBudget(unsigned poolCount);
+
+    static const unsigned sAutoThreads = ~0u;
+
+    unsigned GetThreadCount() const
+    { return (unsigned)m_threads.size(); }
+
+    // Resolve every lookup from MFT table (if set) else volume, return when all are done.
+    void Resolve(HANDLE volHnd, const MftTable* pMftTable, LookupList& lookups);
+
+private:
+    void WorkerLoop();
+    void RunLookups();
+
+private:
+    std::vector<std::thread>    m_threads;
+    std::mutex                  m_lock;
+    std::condition_variable     m_startCv;
+    std::condition_variable     m_doneCv;
+    unsigned                    m_generation;   // bumped for each Resolve
+    unsigned                    m_busy;         // workers still on current generation
+    bool                        m_stop;
+
+    HANDLE                      m_volHnd;
+    const MftTable*             m_pMftTable;
+    LookupList*                 m_pLookups;
+    std::atomic<size_t>         m_next;         // next lookup to take
+};
@@ -0,0 +1,301 @@
+// ------------------------------------------------------------------------------------------------
+// Bulk path table built from one pass over $MFT.
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+#include <stddef.h>
+
+#include "MftTable.h"
+#include "NtfsImage.h"
+#include "ntfstypes.h"
+#include "Hnd.h"
+#include "winerrhandlers.h"
+
+// Records read per I/O.
+static const DWORD sChunkSize = 4 * 1024 * 1024;
+
+// ------------------------------------------------------------------------------------------------
+MftTable::MftTable(void) :
+    m_namedCount(0)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+MftTable::~MftTable(void)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+void MftTable::SaveLastError(DWORD error) const
+{
+    m_errorMsg = WinErrHandlers::LastErrorMsg(error);
+}
+
+// ------------------------------------------------------------------------------------------------
+void MftTable::Clear()
+{
+    m_entries.clear();
+    m_names.clear();
+    m_namedCount = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+void MftTable::Reserve(ULONGLONG recordCount)
+{
+    Entry empty;
+    ZeroMemory(&empty, sizeof(empty));
+    m_entries.assign((size_t)recordCount, empty);
+
+    // Typical names are short, arena grows if needed.
+    m_names.reserve((size_t)recordCount * 16);
+}
+
+// ------------------------------------------------------------------------------------------------
+bool MftTable::Load(const wchar_t* path)
+{
+    Clear();
+
+    Hnd fileHnd = CreateFile(path, GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER fileSize;
+    if (!fileHnd.IsValid() || !GetFileSizeEx(fileHnd, &fileSize))
+    {
+        SaveLastError();
+        return false;
+    }
+
+    // $MFT starts with record 0 "FILE", an image with the NTFS boot sector.
+    BYTE head[16];
+    DWORD bytesRead = 0;
+    if (!ReadFile(fileHnd, head, sizeof(head), &bytesRead, NULL) || bytesRead != sizeof(head))
+    {
+        SaveLastError(ERROR_HANDLE_EOF);
+        return false;
+    }
+
+    if (memcmp(head, "FILE", 4) == 0)
+        return LoadFile(fileHnd, fileSize.QuadPart);
+    if (memcmp(head + 3, "NTFS    ", 8) == 0)
+    {
+        fileHnd = INVALID_HANDLE_VALUE;
+        return LoadImage(path);
+    }
+
+    m_errorMsg = L"Not an $MFT file or NTFS image";
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Extracted $MFT, record size is the allocated length in record 0.
+bool MftTable::LoadFile(HANDLE fileHnd, ULONGLONG fileSize)
+{
+    MFT_FILE_HEADER header;
+    LARGE_INTEGER zero;
+    zero.QuadPart = 0;
+    DWORD bytesRead = 0;
+    if (!SetFilePointerEx(fileHnd, zero, NULL, FILE_BEGIN)
+        || !ReadFile(fileHnd, &header, sizeof(header), &bytesRead, NULL)
+        || bytesRead != sizeof(header))
+    {
+        SaveLastError();
+        return false;
+    }
+
+    DWORD recordSize = header.dwAllLength;
+    if (recordSize < 256 || recordSize > 65536 || (recordSize & (recordSize - 1)) != 0
+        || !SetFilePointerEx(fileHnd, zero, NULL, FILE_BEGIN))
+    {
+        m_errorMsg = L"Invalid $MFT record size";
+        return false;
+    }
+
+    ULONGLONG recordCount = fileSize / recordSize;
+    Reserve(recordCount);
+
+    DWORD chunkRecords = sChunkSize / recordSize;
+    std::vector<BYTE> buffer((size_t)chunkRecords * recordSize);
+    for (ULONGLONG recordNum = 0; recordNum < recordCount; )
+    {
+        DWORD count = (DWORD)min((ULONGLONG)chunkRecords, recordCount - recordNum);
+        if (!ReadFile(fileHnd, &buffer[0], count * recordSize, &bytesRead, NULL)
+            || bytesRead != count * recordSize)
+        {
+            SaveLastError();
+            return false;
+        }
+
+        for (DWORD idx = 0; idx < count; idx++)
+            AddRecord(recordNum + idx, &buffer[(size_t)idx * recordSize], recordSize);
+        recordNum += count;
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// $MFT inside raw volume image, read through its data runs.
+bool MftTable::LoadImage(const wchar_t* imagePath)
+{
+    NtfsImage ntfsImage;
+    if (!ntfsImage.Open(imagePath, false))
+    {
+        m_errorMsg = ntfsImage.GetLastErrorMsg();
+        return false;
+    }
+
+    DWORD recordSize = ntfsImage.GetMftRecordSize();
+    ULONGLONG recordCount = ntfsImage.GetMftRecordCount();
+    Reserve(recordCount);
+
+    DWORD chunkRecords = sChunkSize / recordSize;
+    std::vector<BYTE> buffer((size_t)chunkRecords * recordSize);
+    for (ULONGLONG recordNum = 0; recordNum < recordCount; )
+    {
+        DWORD count = (DWORD)min((ULONGLONG)chunkRecords, recordCount - recordNum);
+        if (!ntfsImage.ReadMft(recordNum * recordSize, &buffer[0], count * recordSize))
+        {
+            m_errorMsg = L"Unable to read $MFT from image";
+            return false;
+        }
+
+        for (DWORD idx = 0; idx < count; idx++)
+            AddRecord(recordNum + idx, &buffer[(size_t)idx * recordSize], recordSize);
+        recordNum += count;
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Parse one raw MFT record into its table entry. Free records keep their last name and
+// parent until reused, so recently deleted files still resolve.
+void MftTable::AddRecord(ULONGLONG recordNum, BYTE* pRecord, DWORD recordSize)
+{
+    const MFT_FILE_HEADER* pHeader = (const MFT_FILE_HEADER*)pRecord;
+    if (memcmp(pHeader->szSignature, "FILE", 4) != 0
+        || !NtfsImage::ApplyFixups(pRecord, recordSize)
+        || pHeader->wAttribOffset >= recordSize)
+        return;
+
+    // Names of files with many attributes can live in extension records, credit them to base.
+    ULONGLONG baseNum = (ULONGLONG)pHeader->n64BaseMftRec & sMftRecordMask;
+    bool isBase = (baseNum == 0);
+    if (!isBase && baseNum >= m_entries.size())
+        return;
+
+    Entry& entry = m_entries[(size_t)(isBase ? recordNum : baseNum)];
+    if (isBase)
+    {
+        entry.sequence = pHeader->wSequence;
+        entry.flags = (BYTE)((pHeader->wFlags & 0x01) ? eInUse : 0);
+    }
+
+    const MFT_FILEINFO* pBestName = NULL;
+    DWORD offset = pHeader->wAttribOffset;
+    while (offset + 16 <= recordSize)
+    {
+        const NTFS_ATTRIBUTE* pAttr = (const NTFS_ATTRIBUTE*)(pRecord + offset);
+        if (pAttr->dwType == eAttrEnd || pAttr->wFullLength == 0
+            || offset + pAttr->wFullLength > recordSize)
+            break;
+
+        if (pAttr->dwType == eAttrFileName && !pAttr->uchNonResFlag
+            && pAttr->Attr.Resident.wAttrOffset + offsetof(MFT_FILEINFO, wFilename) <= pAttr->wFullLength)
+        {
+            // Prefer long name over 8.3 DOS name.
+            const MFT_FILEINFO* pFileInfo = (const MFT_FILEINFO*)((const BYTE*)pAttr + pAttr->Attr.Resident.wAttrOffset);
+            DWORD nameEnd = pAttr->Attr.Resident.wAttrOffset + offsetof(MFT_FILEINFO, wFilename)
+                + pFileInfo->chFileNameLength * sizeof(wchar_t);
+            if (nameEnd <= pAttr->wFullLength && (pBestName == NULL || pBestName->chFileNameType == eDOS))
+                pBestName = pFileInfo;
+        }
+        else if (pAttr->dwType == eAttrData && pAttr->uchNameLength == 0)
+        {
+            if (pAttr->uchNonResFlag)
+            {
+                if (pAttr->Attr.NonResident.n64StartVCN == 0)
+                    entry.allocated = pAttr->Attr.NonResident.n64AllocSize;
+            }
+            else
+            {
+                entry.allocated = (pAttr->Attr.Resident.dwLength + 7) & ~7;
+            }
+        }
+
+        offset += pAttr->wFullLength;
+    }
+
+    if (pBestName != NULL && (entry.nameLength == 0 || isBase))
+    {
+        if (entry.nameLength == 0)
+            m_namedCount++;
+        entry.parentRef = (ULONGLONG)pBestName->dwMftParentDir;
+        entry.nameOffset = (DWORD)m_names.size();
+        entry.nameLength = pBestName->chFileNameLength;
+        m_names.insert(m_names.end(), pBestName->wFilename, pBestName->wFilename + pBestName->chFileNameLength);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return true if table entry still describes record with sequence. Journal ids of deleted files
+// carry the sequence before the delete, NTFS bumps it when the record is freed.
+bool MftTable::IsSequence(const Entry& entry, WORD sequence)
+{
+    if (sequence == 0 || entry.sequence == sequence)
+        return true;
+    return (entry.flags & eInUse) == 0 && entry.sequence == (WORD)(sequence + 1);
+}
+
+// ------------------------------------------------------------------------------------------------
+bool MftTable::IsMatch(const FileRef& fileId, ULONGLONG& recordNum) const
+{
+    if (!fileId.Is64())
+        return false;
+
+    recordNum = fileId.low & sMftRecordMask;
+    if (recordNum >= m_entries.size())
+        return false;
+
+    const Entry& entry = m_entries[(size_t)recordNum];
+    return entry.nameLength != 0 && IsSequence(entry, (WORD)(fileId.low >> 48));
+}
+
+// ------------------------------------------------------------------------------------------------
+bool MftTable::GetFileInfo(const FileRef& fileId, std::wstring& fullPath, LARGE_INTEGER& allocatedSize) const
+{
+    ULONGLONG recordNum;
+    if (!IsMatch(fileId, recordNum))
+        return false;
+
+    allocatedSize.QuadPart = m_entries[(size_t)recordNum].allocated;
+
+    // Collect names leaf to root, then join them root first.
+    // A parent whose record was reused (sequence differs) is not the directory the file was in.
+    const Entry* chain[sMaxDepth];
+    unsigned depth = 0;
+    size_t length = 0;
+    while (recordNum != eMftRecRoot)
+    {
+        if (depth == sMaxDepth || recordNum >= m_entries.size())
+            return false;
+        const Entry& entry = m_entries[(size_t)recordNum];
+        if (entry.nameLength == 0)
+            return false;
+        if (depth != 0 && !IsSequence(entry, (WORD)(chain[depth - 1]->parentRef >> 48)))
+            return false;
+
+        chain[depth++] = &entry;
+        length += entry.nameLength + 1;
+        recordNum = entry.parentRef & sMftRecordMask;
+    }
+
+    fullPath.clear();
+    fullPath.reserve(length);
+    while (depth != 0)
+    {
+        const Entry& entry = *chain[--depth];
+        fullPath += L'\\';
+        fullPath.append(&m_names[entry.nameOffset], entry.nameLength);
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+// ------------------------------------------------------------------------------------------------
+// Bulk path table built from one pass over $MFT.
+// Load an extracted $MFT file or the $MFT inside a raw volume image into a dense table
+// indexed by MFT record number (parent, name, sequence, allocated size), so path and
+// size lookups are array indexes instead of one open-by-id call per file.
+// Windows only: file I/O uses CreateFile/ReadFile and record fixups come from NtfsImage.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "FileRef.h"
+
+using namespace std;
+
+class NtfsImage;
+
+class MftTable
+{
+public:
+    MftTable(void);
+    ~MftTable(void);
+
+    // Load extracted $MFT file or raw NTFS image, detected from content.
+    bool Load(const wchar_t* path);
+    void Clear();
+
+    // Volume relative path (\dir\name) and allocated size of file id.
+    // Return false if record or one of its parents is unknown or was reused (sequence differs).
+    bool GetFileInfo(const FileRef& fileId, std::wstring& fullPath, LARGE_INTEGER& allocatedSize) const;
+
+    ULONGLONG GetRecordCount() const
+    { return m_entries.size(); }
+    ULONGLONG GetNamedCount() const
+    { return m_namedCount; }
+
+    wstring GetLastErrorMsg() const
+    { return m_errorMsg; }
+
+private:
+    bool LoadFile(HANDLE fileHnd, ULONGLONG fileSize);
+    bool LoadImage(const wchar_t* imagePath);
+    void Reserve(ULONGLONG recordCount);
+    void AddRecord(ULONGLONG recordNum, BYTE* pRecord, DWORD recordSize);
+    bool IsMatch(const FileRef& fileId, ULONGLONG& recordNum) const;
+
+    void SaveLastError(DWORD error=0) const;
+
+private:
+    struct Entry
+    {
+        ULONGLONG   parentRef;      // Seq[2] MFT record[6] of parent directory
+        LONGLONG    allocated;      // allocated size of unnamed data stream
+        DWORD       nameOffset;     // into m_names
+        BYTE        nameLength;     // characters, 0 if record has no name
+        BYTE        flags;          // eInUse
+        WORD        sequence;
+    };
+    enum EntryFlags { eInUse = 0x01 };
+
+    static bool IsSequence(const Entry& entry, WORD sequence);
+
+    static const unsigned sMaxDepth = 256;  // guard against parent cycles in damaged $MFT
+
+    std::vector<Entry>      m_entries;      // indexed by MFT record number
+    std::vector<wchar_t>    m_names;        // name arena
+    ULONGLONG               m_namedCount;
+    mutable wstring         m_errorMsg;
+};
@@ -0,0 +1,615 @@
+// ------------------------------------------------------------------------------------------------
+// Raw NTFS volume image (dd) reader.
+// Parse boot sector and $MFT to locate $Extend\$UsnJrnl:$J and stream the journal
+// straight from the image, run by run, without extracting the sparse stream.
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+#include <algorithm>
+
+#include "NtfsImage.h"
+#include "winerrhandlers.h"
+
+// Update sequence (fixup) array protects the last WORD of every 512 byte block.
+static const DWORD sFixupStride = 512;
+
+// Journal read size, journal data is only read from allocated clusters.
+static const DWORD sChunkSize = 1024 * 1024;
+
+// ------------------------------------------------------------------------------------------------
+// Return true if counted (not terminated) pName matches name, ignoring case.
+// NULL name matches unnamed attribute.
+static bool IsName(const wchar_t* pName, unsigned nameLen, const wchar_t* name)
+{
+    if (name == NULL)
+        return nameLen == 0;
+    return wcslen(name) == nameLen && _wcsnicmp(pName, name, nameLen) == 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+NtfsImage::NtfsImage(void) :
+    m_bytesPerSector(0),
+    m_bytesPerCluster(0),
+    m_mftRecordSize(0),
+    m_indexRecordSize(0),
+    m_mftSize(0),
+    m_usnSize(0),
+    m_pos(0),
+    m_extEnd(0),
+    m_runIdx(0)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+NtfsImage::~NtfsImage(void)
+{
+    Close();
+}
+
+// ------------------------------------------------------------------------------------------------
+void NtfsImage::Close()
+{
+    m_imgHnd = INVALID_HANDLE_VALUE;
+    m_mftRuns.clear();
+    m_usnRuns.clear();
+    m_mftSize = m_usnSize = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool NtfsImage::Open(const wchar_t* imagePath, bool findJournal)
+{
+    Close();
+
+    m_imgHnd = CreateFile(imagePath, GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (!m_imgHnd.IsValid())
+    {
+        SaveLastError();
+        return false;
+    }
+
+    NTFS_BOOT_SECTOR bootSector;
+    if (!ReadAt(0, &bootSector, sizeof(bootSector)))
+    {
+        Close();
+        return false;
+    }
+
+    if (memcmp(bootSector.szOemId, "NTFS    ", sizeof(bootSector.szOemId)) != 0
+        || bootSector.wEndMarker != 0xAA55)
+    {
+        SaveErrorMsg(L"Image does not start with an NTFS boot sector");
+        Close();
+        return false;
+    }
+
+    m_bytesPerSector = bootSector.wBytesPerSector;
+    DWORD secPerCluster = (bootSector.uchSecPerCluster <= 0x80) ?
+        bootSector.uchSecPerCluster : (1u << (256 - bootSector.uchSecPerCluster));
+    m_bytesPerCluster = m_bytesPerSector * secPerCluster;
+
+    m_mftRecordSize = (bootSector.chClustersPerMftRec > 0) ?
+        bootSector.chClustersPerMftRec * m_bytesPerCluster : (1u << -bootSector.chClustersPerMftRec);
+    m_indexRecordSize = (bootSector.chClustersPerIndexRec > 0) ?
+        bootSector.chClustersPerIndexRec * m_bytesPerCluster : (1u << -bootSector.chClustersPerIndexRec);
+
+    if (m_bytesPerSector < 256 || m_bytesPerCluster == 0
+        || m_mftRecordSize < 256 || m_mftRecordSize > 65536
+        || m_indexRecordSize < 256 || m_indexRecordSize > 65536)
+    {
+        SaveErrorMsg(L"Invalid NTFS boot sector geometry");
+        Close();
+        return false;
+    }
+
+    // Bootstrap $MFT access with a run covering its own record, then load its real runs.
+    DataRun bootRun;
+    bootRun.vcn = 0;
+    bootRun.lcn = bootSector.n64MftLcn;
+    bootRun.length = (m_mftRecordSize + m_bytesPerCluster - 1) / m_bytesPerCluster;
+    m_mftRuns.assign(1, bootRun);
+    m_mftSize = m_mftRecordSize;
+
+    std::vector<BYTE> record;
+    const NTFS_ATTRIBUTE* pMftData;
+    if (!ReadMftRecord(eMftRecMft, record)
+        || (pMftData = FindAttribute(record, eAttrData, NULL, 0)) == NULL)
+    {
+        SaveErrorMsg(L"Unable to read $MFT record");
+        Close();
+        return false;
+    }
+
+    DataRunList mftRuns;
+    if (!DecodeDataRuns(pMftData, mftRuns))
+    {
+        SaveErrorMsg(L"Invalid $MFT data runs");
+        Close();
+        return false;
+    }
+    m_mftRuns = mftRuns;
+    m_mftSize = pMftData->Attr.NonResident.n64RealSize;
+
+    // Fragmented $MFT keeps remaining runs in extension records ($ATTRIBUTE_LIST).
+    if (!LoadStreamRuns(eMftRecMft, eAttrData, NULL, mftRuns, m_mftSize))
+    {
+        Close();
+        return false;
+    }
+    m_mftRuns = mftRuns;
+
+    if (!findJournal)
+        return true;
+
+    ULONGLONG usnRecordNum;
+    if (!FindInIndex(eMftRecExtend, L"$UsnJrnl", usnRecordNum)
+        && !FindByParent(eMftRecExtend, L"$UsnJrnl", usnRecordNum))
+    {
+        SaveErrorMsg(L"$Extend\\$UsnJrnl not found, journal not active on volume");
+        Close();
+        return false;
+    }
+
+    if (!LoadStreamRuns(usnRecordNum, eAttrData, L"$J", m_usnRuns, m_usnSize))
+    {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool NtfsImage::ReadAt(ULONGLONG offset, void* pBuffer, DWORD length)
+{
+    OVERLAPPED overlapped;
+    ZeroMemory(&overlapped, sizeof(overlapped));
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD bytesRead = 0;
+    if (!ReadFile(m_imgHnd, pBuffer, length, &bytesRead, &overlapped))
+    {
+        SaveLastError();
+        return false;
+    }
+
+    if (bytesRead != length)
+    {
+        SaveLastError(ERROR_HANDLE_EOF);
+        return false;
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool NtfsImage::ReadStream(const DataRunList& runs, ULONGLONG offset, void* pBuffer, DWORD length)
+{
+    BYTE* pOut = (BYTE*)pBuffer;
+
+    while (length != 0)
+    {
+        // Last run starting at or before vcn.
+        LONGLONG vcn = offset / m_bytesPerCluster;
+        DataRunList::const_iterator iter = std::upper_bound(runs.begin(), runs.end(), vcn,
+            [](LONGLONG value, const DataRun& run) { return value < run.vcn; });
+        if (iter == runs.begin() || vcn >= iter[-1].vcn + iter[-1].length)
+        {
+            SaveErrorMsg(L"Stream offset not covered by its data runs");
+            return false;
+        }
+        --iter;
+
+        ULONGLONG runOffset = offset - (ULONGLONG)iter->vcn * m_bytesPerCluster;
+        ULONGLONG runAvail = (ULONGLONG)iter->length * m_bytesPerCluster - runOffset;
+        DWORD part = (runAvail < length) ? (DWORD)runAvail : length;
+
+        if (iter->lcn < 0)
+            ZeroMemory(pOut, part);
+        else if (!ReadAt((ULONGLONG)iter->lcn * m_bytesPerCluster + runOffset, pOut, part))
+            return false;
+
+        pOut += part;
+        offset += part;
+        length -= part;
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Replace last WORD of every 512 byte block with its saved value from the update sequence array.
+bool NtfsImage::ApplyFixups(BYTE* pRecord, DWORD length)
+{
+    WORD usaOffset = *(const WORD*)(pRecord + 4);
+    WORD usaCount = *(const WORD*)(pRecord + 6);
+
+    if (usaCount < 2 || (DWORD)usaOffset + usaCount * sizeof(WORD) > length
+        || (usaCount - 1) * sFixupStride > length)
+        return false;
+
+    const WORD* pUsa = (const WORD*)(pRecord + usaOffset);
+    for (WORD idx = 1; idx < usaCount; idx++)
+    {
+        WORD* pBlockEnd = (WORD*)(pRecord + idx * sFixupStride - sizeof(WORD));
+        if (*pBlockEnd != pUsa[0])
+            return false;   // torn write
+        *pBlockEnd = pUsa[idx];
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool NtfsImage::ReadMftRecord(ULONGLONG recordNum, std::vector<BYTE>& record)
+{
+    ULONGLONG offset = recordNum * m_mftRecordSize;
+    if (offset + m_mftRecordSize > (ULONGLONG)m_mftSize)
+        return false;
+
+    record.resize(m_mftRecordSize);
+    if (!ReadStream(m_mftRuns, offset, &record[0], m_mftRecordSize))
+        return false;
+
+    const MFT_FILE_HEADER* pHeader = (const MFT_FILE_HEADER*)&record[0];
+    if (memcmp(pHeader->szSignature, "FILE", 4) != 0
+        || !ApplyFixups(&record[0], m_mftRecordSize)
+        || pHeader->wAttribOffset >= m_mftRecordSize)
+        return false;
+
+    return (pHeader->wFlags & 0x01) != 0;   // in use
+}
+
+// ------------------------------------------------------------------------------------------------
+const NTFS_ATTRIBUTE* NtfsImage::FindAttribute(
+        const std::vector<BYTE>& record, DWORD type, const wchar_t* name, LONGLONG startVcn)
+{
+    const MFT_FILE_HEADER* pHeader = (const MFT_FILE_HEADER*)&record[0];
+    DWORD offset = pHeader->wAttribOffset;
+
+    while (offset + 16 <= record.size())
+    {
+        const NTFS_ATTRIBUTE* pAttr = (const NTFS_ATTRIBUTE*)&record[offset];
+        if (pAttr->dwType == eAttrEnd || pAttr->wFullLength == 0
+            || offset + pAttr->wFullLength > record.size())
+            break;
+
+        if (pAttr->dwType == type
+            && IsName((const wchar_t*)((const BYTE*)pAttr + pAttr->wNameOffset), pAttr->uchNameLength, name)
+            && (startVcn < 0 || (pAttr->uchNonResFlag && pAttr->Attr.NonResident.n64StartVCN == startVcn)))
+            return pAttr;
+
+        offset += pAttr->wFullLength;
+    }
+
+    return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool NtfsImage::DecodeDataRuns(const NTFS_ATTRIBUTE* pAttr, DataRunList& runs)
+{
+    if (!pAttr->uchNonResFlag)
+        return false;
+
+    const BYTE* pRun = (const BYTE*)pAttr + pAttr->Attr.NonResident.wDatarunOffset;
+    const BYTE* pEnd = (const BYTE*)pAttr + pAttr->wFullLength;
+    LONGLONG vcn = pAttr->Attr.NonResident.n64StartVCN;
+    LONGLONG lcn = 0;
+
+    // Each run: header byte (offset size << 4 | length size), length, signed lcn delta.
+    while (pRun < pEnd && *pRun != 0)
+    {
+        unsigned lenSize = *pRun & 0x0f;
+        unsigned offSize = *pRun >> 4;
+        pRun++;
+        if (lenSize == 0 || lenSize > 8 || offSize > 8 || pRun + lenSize + offSize > pEnd)
+            return false;
+
+        DataRun run;
+        run.vcn = vcn;
+        run.length = 0;
+        for (unsigned idx = 0; idx < lenSize; idx++)
+            run.length |= (LONGLONG)pRun[idx] << (8 * idx);
+        pRun += lenSize;
+
+        if (offSize == 0)
+        {
+            run.lcn = -1;   // sparse
+        }
+        else
+        {
+            LONGLONG delta = 0;
+            for (unsigned idx = 0; idx < offSize; idx++)
+                delta |= (LONGLONG)pRun[idx] << (8 * idx);
+            if (offSize < 8 && (pRun[offSize - 1] & 0x80) != 0)
+                delta |= ~(LONGLONG)0 << (8 * offSize);
+            pRun += offSize;
+            lcn += delta;
+            run.lcn = lcn;
+        }
+
+        runs.push_back(run);
+        vcn += run.length;
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Collect all runs of non-resident stream, following $ATTRIBUTE_LIST into extension records.
+bool NtfsImage::LoadStreamRuns(
+        ULONGLONG recordNum, DWORD type, const wchar_t* name,
+        DataRunList& runs, LONGLONG& streamSize)
+{
+    runs.clear();
+
+    std::vector<BYTE> record;
+    if (!ReadMftRecord(recordNum, record))
+    {
+        SaveErrorMsg(L"Unable to read MFT record");
+        return false;
+    }
+
+    const NTFS_ATTRIBUTE* pList = FindAttribute(record, eAttrAttributeList, NULL);
+    if (pList == NULL)
+    {
+        const NTFS_ATTRIBUTE* pAttr = FindAttribute(record, type, name, 0);
+        if (pAttr == NULL || !DecodeDataRuns(pAttr, runs))
+        {
+            SaveErrorMsg(L"Stream not found or not a non-resident stream");
+            return false;
+        }
+        streamSize = pAttr->Attr.NonResident.n64RealSize;
+        return true;
+    }
+
+    std::vector<BYTE> listData;
+    if (pList->uchNonResFlag)
+    {
+        DataRunList listRuns;
+        listData.resize((size_t)pList->Attr.NonResident.n64RealSize);
+        if (listData.empty() || !DecodeDataRuns(pList, listRuns)
+            || !ReadStream(listRuns, 0, &listData[0], (DWORD)listData.size()))
+        {
+            SaveErrorMsg(L"Unable to read $ATTRIBUTE_LIST");
+            return false;
+        }
+    }
+    else
+    {
+        const BYTE* pValue = (const BYTE*)pList + pList->Attr.Resident.wAttrOffset;
+        listData.assign(pValue, pValue + pList->Attr.Resident.dwLength);
+    }
+
+    std::vector<BYTE> extRecord;
+    size_t offset = 0;
+    while (offset + sizeof(MFT_ATTRIBUTE_LIST_ENTRY) <= listData.size())
+    {
+        const MFT_ATTRIBUTE_LIST_ENTRY* pEntry = (const MFT_ATTRIBUTE_LIST_ENTRY*)&listData[offset];
+        if (pEntry->wRecLength == 0 || offset + pEntry->wRecLength > listData.size())
+            break;
+
+        if (pEntry->dwType == type
+            && IsName((const wchar_t*)((const BYTE*)pEntry + pEntry->uchNameOffset), pEntry->uchNameLength, name))
+        {
+            ULONGLONG extRecordNum = pEntry->n64FileRef & sMftRecordMask;
+            const std::vector<BYTE>* pRecord = &record;
+            if (extRecordNum != recordNum)
+            {
+                if (!ReadMftRecord(extRecordNum, extRecord))
+                {
+                    SaveErrorMsg(L"Unable to read MFT extension record");
+                    return false;
+                }
+                pRecord = &extRecord;
+            }
+
+            const NTFS_ATTRIBUTE* pAttr = FindAttribute(*pRecord, type, name, pEntry->n64StartVCN);
+            if (pAttr == NULL || !DecodeDataRuns(pAttr, runs))
+            {
+                SaveErrorMsg(L"Invalid stream extent in MFT extension record");
+                return false;
+            }
+            if (pEntry->n64StartVCN == 0)
+                streamSize = pAttr->Attr.NonResident.n64RealSize;
+        }
+
+        offset += pEntry->wRecLength;
+    }
+
+    std::sort(runs.begin(), runs.end(),
+        [](const DataRun& lhs, const DataRun& rhs) { return lhs.vcn < rhs.vcn; });
+
+    if (runs.empty())
+        SaveErrorMsg(L"Stream not found");
+    return !runs.empty();
+}
+
+// ------------------------------------------------------------------------------------------------
+// Scan index entries between pEntry and pEnd for file name.
+// Entry sizes and name lengths of a damaged image are bounded by pEnd.
+static bool ScanIndexEntries(const BYTE* pEntry, const BYTE* pEnd, const wchar_t* name, ULONGLONG& recordNum)
+{
+    while (pEntry + offsetof(MFT_INDEX_ENTRY, fileInfo) <= pEnd)
+    {
+        const MFT_INDEX_ENTRY* pIndexEntry = (const MFT_INDEX_ENTRY*)pEntry;
+        if (pIndexEntry->size < offsetof(MFT_INDEX_ENTRY, fileInfo) || (pIndexEntry->flags & 0x02) != 0)
+            break;  // last entry has no key
+        if ((size_t)(pEnd - pEntry) < pIndexEntry->size)
+            break;
+
+        const BYTE* pEntryEnd = pEntry + pIndexEntry->size;
+        if (pIndexEntry->fileInfoSize != 0
+            && (const BYTE*)pIndexEntry->fileInfo.wFilename <= pEntryEnd
+            && (size_t)(pEntryEnd - (const BYTE*)pIndexEntry->fileInfo.wFilename) >= pIndexEntry->fileInfo.chFileNameLength * sizeof(wchar_t)
+            && IsName(pIndexEntry->fileInfo.wFilename, pIndexEntry->fileInfo.chFileNameLength, name))
+        {
+            recordNum = pIndexEntry->fileRef & sMftRecordMask;
+            return true;
+        }
+
+        pEntry += pIndexEntry->size;
+    }
+
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Find name in directory $I30 index. All index blocks are scanned, intended for small
+// directories such as $Extend.
+bool NtfsImage::FindInIndex(ULONGLONG dirRecordNum, const wchar_t* name, ULONGLONG& recordNum)
+{
+    std::vector<BYTE> record;
+    if (!ReadMftRecord(dirRecordNum, record))
+        return false;
+
+    const NTFS_ATTRIBUTE* pRoot = FindAttribute(record, eAttrIndexRoot, L"$I30");
+    if (pRoot == NULL || pRoot->uchNonResFlag)
+        return false;
+
+    // Root entries are resident, bounded by the MFT record.
+    const BYTE* pRecordEnd = &record[0] + record.size();
+    const MFT_INDEX_ROOT* pIndexRoot = (const MFT_INDEX_ROOT*)((const BYTE*)pRoot + pRoot->Attr.Resident.wAttrOffset);
+    if ((const BYTE*)pIndexRoot->entries > pRecordEnd)
+        return false;
+    const BYTE* pHeader = (const BYTE*)&pIndexRoot->header;
+    const BYTE* pRootEnd = pHeader + pIndexRoot->header.totalSizeEntries;
+    if (pIndexRoot->header.totalSizeEntries > (size_t)(pRecordEnd - pHeader))
+        pRootEnd = pRecordEnd;
+    if (pIndexRoot->header.offsetEntry < (size_t)(pRootEnd - pHeader)
+        && ScanIndexEntries(pHeader + pIndexRoot->header.offsetEntry, pRootEnd, name, recordNum))
+        return true;
+
+    const NTFS_ATTRIBUTE* pAlloc = FindAttribute(record, eAttrIndexAllocation, L"$I30");
+    DataRunList indexRuns;
+    if (pAlloc == NULL || !DecodeDataRuns(pAlloc, indexRuns))
+        return false;
+
+    std::vector<BYTE> block(m_indexRecordSize);
+    ULONGLONG indexSize = pAlloc->Attr.NonResident.n64RealSize;
+    for (ULONGLONG offset = 0; offset + m_indexRecordSize <= indexSize; offset += m_indexRecordSize)
+    {
+        if (!ReadStream(indexRuns, offset, &block[0], m_indexRecordSize))
+            return false;
+
+        const MFT_INDEX_ALLOCATION* pIndx = (const MFT_INDEX_ALLOCATION*)&block[0];
+        if (memcmp(pIndx->magicNumber, "INDX", 4) != 0 || !ApplyFixups(&block[0], m_indexRecordSize))
+            continue;
+
+        // Entry offsets are relative to the index header which follows the VCN.
+        const BYTE* pIndexHeader = &block[0] + offsetof(MFT_INDEX_ALLOCATION, indexEntryOffs);
+        const BYTE* pBlockEnd = &block[0] + m_indexRecordSize;
+        const BYTE* pEnd = pIndexHeader + pIndx->sizeOFEntries;
+        if (pIndx->sizeOFEntries > (size_t)(pBlockEnd - pIndexHeader))
+            pEnd = pBlockEnd;
+        if (pIndx->indexEntryOffs < (size_t)(pEnd - pIndexHeader)
+            && ScanIndexEntries(pIndexHeader + pIndx->indexEntryOffs, pEnd, name, recordNum))
+            return true;
+    }
+
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Slow fallback, scan MFT records for file name attribute with matching parent.
+bool NtfsImage::FindByParent(ULONGLONG parentRecordNum, const wchar_t* name, ULONGLONG& recordNum)
+{
+    std::vector<BYTE> record;
+    ULONGLONG recordCount = GetMftRecordCount();
+
+    for (ULONGLONG recNum = eMftRecFirstUser; recNum < recordCount; recNum++)
+    {
+        if (!ReadMftRecord(recNum, record))
+            continue;
+
+        const NTFS_ATTRIBUTE* pAttr = FindAttribute(record, eAttrFileName, NULL);
+        if (pAttr == NULL || pAttr->uchNonResFlag)
+            continue;
+
+        const MFT_FILEINFO* pFileInfo = (const MFT_FILEINFO*)((const BYTE*)pAttr + pAttr->Attr.Resident.wAttrOffset);
+        if ((ULONGLONG)(pFileInfo->dwMftParentDir & sMftRecordMask) == parentRecordNum
+            && IsName(pFileInfo->wFilename, pFileInfo->chFileNameLength, name))
+        {
+            recordNum = recNum;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool NtfsImage::Start(USN startUsn, DWORD)
+{
+    if (!IsOpen())
+        return false;
+
+    // Records are 8 byte aligned.
+    m_buffer.resize(sChunkSize);
+    m_pos = (startUsn > 0) ? ((ULONGLONG)startUsn & ~(ULONGLONG)7) : 0;
+    m_extEnd = m_pos;
+    m_runIdx = 0;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Stream $J from image. Sparse runs are skipped without I/O, consecutive allocated runs
+// are read in large chunks.
+bool NtfsImage::ReadBatch(JournalBatch& batch)
+{
+    const ULONGLONG pageMask = ~(ULONGLONG)(sPageSize - 1);
+    const ULONGLONG streamEnd = (ULONGLONG)m_usnSize;
+
+    while (m_pos >= m_extEnd)
+    {
+        if (m_runIdx >= m_usnRuns.size())
+            return false;
+
+        // Extent of consecutive runs of same kind (allocated or sparse).
+        bool sparse = m_usnRuns[m_runIdx].lcn < 0;
+        ULONGLONG extStart = (ULONGLONG)m_usnRuns[m_runIdx].vcn * m_bytesPerCluster;
+        ULONGLONG extEnd = extStart;
+        for (; m_runIdx < m_usnRuns.size() && (m_usnRuns[m_runIdx].lcn < 0) == sparse; m_runIdx++)
+            extEnd = (ULONGLONG)(m_usnRuns[m_runIdx].vcn + m_usnRuns[m_runIdx].length) * m_bytesPerCluster;
+
+        if (extEnd > streamEnd)
+            extEnd = streamEnd;
+        if (extStart < m_pos)
+            extStart = m_pos;
+        if (extStart >= extEnd)
+            continue;
+
+        if (sparse)
+        {
+            m_skippedBytes += extEnd - extStart;
+            m_pos = extEnd;
+            continue;
+        }
+
+        m_pos = extStart;
+        m_extEnd = extEnd;
+    }
+
+    // Chunks end on a page boundary so no record is split.
+    ULONGLONG end = m_pos + sChunkSize;
+    if (end < m_extEnd)
+        end &= pageMask;
+    else
+        end = m_extEnd;
+
+    DWORD length = (DWORD)(end - m_pos);
+    if (!ReadStream(m_usnRuns, m_pos, &m_buffer[0], length))
+        return ReadFailed();
+
+    batch.pData     = &m_buffer[0];
+    batch.length    = length;
+    batch.isStream  = true;
+    batch.streamUsn = m_pos;
+    batch.nextUsn   = (USN)end;
+
+    m_bytesRead += length;
+    m_batchCount++;
+    m_pos = end;
+    return true;
+}
@@ -0,0 +1,97 @@
+// ------------------------------------------------------------------------------------------------
+// Raw NTFS volume image (dd) reader.
+// Parse boot sector and $MFT to locate $Extend\$UsnJrnl:$J and stream the journal
+// straight from the image, run by run, without extracting the sparse stream.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Hnd.h"
+#include "JournalSource.h"
+#include "ntfstypes.h"
+
+class NtfsImage : public JournalSource
+{
+public:
+    NtfsImage(void);
+    ~NtfsImage(void);
+
+    // Open image, parse boot sector, $MFT and locate $UsnJrnl:$J (unless findJournal false).
+    bool Open(const wchar_t* imagePath, bool findJournal = true);
+    void Close();
+    bool IsOpen() const
+    { return m_imgHnd.IsValid(); }
+
+    // JournalSource, $J is read from allocated clusters only,
+    // sparse runs are counted as skipped.
+    virtual bool Start(USN startUsn, DWORD reasonFilter);
+    virtual bool ReadBatch(JournalBatch& batch);
+
+    // Non-resident stream extent, lcn is -1 for sparse run.
+    struct DataRun
+    {
+        LONGLONG vcn;
+        LONGLONG lcn;
+        LONGLONG length;    // clusters
+    };
+    typedef std::vector<DataRun> DataRunList;
+
+    DWORD GetBytesPerCluster() const
+    { return m_bytesPerCluster; }
+
+    DWORD GetMftRecordSize() const
+    { return m_mftRecordSize; }
+
+    // Number of records in $MFT.
+    ULONGLONG GetMftRecordCount() const
+    { return m_mftSize / m_mftRecordSize; }
+
+    // Read MFT record with fixups applied, return false if not in use or damaged.
+    bool ReadMftRecord(ULONGLONG recordNum, std::vector<BYTE>& record);
+
+    // Read 'length' bytes at 'offset' of non-resident stream, sparse runs read as zero.
+    bool ReadStream(const DataRunList& runs, ULONGLONG offset, void* pBuffer, DWORD length);
+
+    // Read raw (no fixups) $MFT bytes, for bulk record scans.
+    bool ReadMft(ULONGLONG offset, void* pBuffer, DWORD length)
+    { return ReadStream(m_mftRuns, offset, pBuffer, length); }
+
+    // Apply update sequence array of MFT or INDX record, return false if torn or damaged.
+    static bool ApplyFixups(BYTE* pRecord, DWORD length);
+
+    // Return attribute of 'type' and optional 'name' in MFT record, or NULL.
+    static const NTFS_ATTRIBUTE* FindAttribute(
+            const std::vector<BYTE>& record, DWORD type, const wchar_t* name, LONGLONG startVcn = -1);
+
+    // Decode non-resident attribute data runs and append to runs.
+    static bool DecodeDataRuns(const NTFS_ATTRIBUTE* pAttr, DataRunList& runs);
+
+private:
+    bool ReadAt(ULONGLONG offset, void* pBuffer, DWORD length);
+    bool LoadStreamRuns(ULONGLONG recordNum, DWORD type, const wchar_t* name,
+            DataRunList& runs, LONGLONG& streamSize);
+    bool FindInIndex(ULONGLONG dirRecordNum, const wchar_t* name, ULONGLONG& recordNum);
+    bool FindByParent(ULONGLONG parentRecordNum, const wchar_t* name, ULONGLONG& recordNum);
+private:
+    Hnd                     m_imgHnd;
+
+    // Volume geometry from boot sector.
+    DWORD                   m_bytesPerSector;
+    DWORD                   m_bytesPerCluster;
+    DWORD                   m_mftRecordSize;
+    DWORD                   m_indexRecordSize;
+
+    DataRunList             m_mftRuns;
+    LONGLONG                m_mftSize;
+    DataRunList             m_usnRuns;
+    LONGLONG                m_usnSize;
+
+    // Journal read position.
+    std::vector<BYTE>       m_buffer;
+    ULONGLONG               m_pos;          // stream offset of next batch
+    ULONGLONG               m_extEnd;       // end of allocated extent holding m_pos
+    size_t                  m_runIdx;       // next $J run to examine
+};
@@ -0,0 +1,258 @@
+// ------------------------------------------------------------------------------------------------
+// Output format (-F) compiled once into a list of literal and field operations.
+// ------------------------------------------------------------------------------------------------
+
+#include "OutputFormat.h"
+#include "ntfsutil.h"
+#include "localefmt.h"
+
+// ------------------------------------------------------------------------------------------------
+OutputFormat::OutputFormat(void) :
+    m_fields(0),
+    m_splitPath(false),
+    m_newLine(true)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+// Adjacent literal text is merged into one operation.
+
+void OutputFormat::AddLiteral(const wchar_t* pStr, size_t length)
+{
+    if (!m_ops.empty() && m_ops.back().type == eOpLiteral)
+    {
+        m_ops.back().length += (DWORD)length;
+    }
+    else
+    {
+        Op op = { eOpLiteral, 0, (DWORD)m_literals.length(), (DWORD)length };
+        m_ops.push_back(op);
+    }
+    m_literals.append(pStr, length);
+}
+
+// ------------------------------------------------------------------------------------------------
+void OutputFormat::AddField(OpType type, long width)
+{
+    Op op = { (BYTE)type, (int)width, 0, 0 };
+    m_ops.push_back(op);
+    if (type >= eOpDirectory && type <= eOpName)
+        m_splitPath = true;
+
+    // Name, extension and directory are slices of the path, records with the
+    // same file name must still be told apart (deleted file duplicates).
+    switch (type)
+    {
+    case eOpAttribute:  m_fields |= eFieldAttribute;    break;
+    case eOpTime:       m_fields |= eFieldTime;         break;
+    case eOpSize:       m_fields |= eFieldSize;         break;
+    case eOpReason:     m_fields |= eFieldReason;       break;
+    case eOpRanges:     break;
+    default:            m_fields |= eFieldPath;         break;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Format output using special meta strings which start with %
+//      %t=time, %s=size, %r=reason
+//      %p=path(dir+filename), %c=drive, %d=directory 
+//      %f=filename (name+ext), %n=name, %e=extension 
+//      %x=changed byte ranges (V4 range tracking records)
+//
+// All formats can include a field width to force padding with spaces.
+//   %20f  will output the filename in 20 characters or more.
+
+void OutputFormat::Compile(const ReportCfg& cfg)
+{
+    m_ops.clear();
+    m_literals.clear();
+    m_fields = 0;
+    m_splitPath = false;
+    m_newLine = true;
+    if (cfg.outputFmt == NULL)
+        return;
+
+    for (const wchar_t* pFmt = cfg.outputFmt; *pFmt != 0; pFmt++)
+    {
+#ifdef BACKSLASH_SPECIAL
+        if (*pFmt == '\\')
+        {
+            wchar_t chr;
+            switch (*++pFmt)
+            {
+            case 0:
+                return;
+            case 'n':
+                chr = '\n';
+                break;
+            case 'r':
+                chr = '\r';
+                break;
+            case 't':
+                chr = '\t';
+                break;
+            case 'x':
+            {
+                wchar_t* endPtr;
+                long n = wcstol(pFmt, &endPtr, 16);
+                if (endPtr == pFmt)
+                    continue;
+                chr = (wchar_t)(BYTE)n;
+                pFmt = endPtr - 1;
+            }
+            break;
+            default:
+                chr = *pFmt;
+                break;
+            }
+            AddLiteral(&chr, 1);
+            continue;
+        }
+#endif
+        if (*pFmt != cfg.fmtChr)
+        {
+            AddLiteral(pFmt, 1);
+            continue;
+        }
+
+        pFmt++;
+        if (*pFmt == 0)
+        {
+            m_newLine = false;
+            return;
+        }
+        if (*pFmt == cfg.fmtChr)
+        {
+            AddLiteral(pFmt, 1);
+            continue;
+        }
+
+        wchar_t* endPtr;
+        long fieldWidth = wcstol(pFmt, &endPtr, 10);
+        if (endPtr == pFmt)
+            fieldWidth = 0;
+        pFmt = endPtr;
+        switch (*pFmt)
+        {
+        case 0:
+            return;
+        case 'a':   AddField(eOpAttribute, fieldWidth);   break;
+        case 't':   AddField(eOpTime, fieldWidth);        break;
+        case 's':   AddField(eOpSize, fieldWidth);        break;
+        case 'r':   AddField(eOpReason, fieldWidth);      break;
+        case 'p':   AddField(eOpPath, fieldWidth);        break;
+        case 'd':   AddField(eOpDirectory, fieldWidth);   break;
+        case 'f':   AddField(eOpFileName, fieldWidth);    break;
+        case 'n':   AddField(eOpName, fieldWidth);        break;
+        case 'e':   AddField(eOpExtension, fieldWidth);   break;
+        case 'x':   AddField(eOpRanges, fieldWidth);      break;
+        default:
+            AddLiteral(pFmt, 1);
+            break;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void OutputFormat::WriteAttributes(const ReportCfg& cfg, DWORD fileAttr, OutputWriter& out)
+{
+    wchar_t attributes[32];
+    size_t length = 0;
+    if (eDirectory & fileAttr)
+    {
+        size_t dirLength = wcslen(cfg.dirAttr);
+        if (dirLength > ARRAYSIZE(attributes) - 3)
+            dirLength = ARRAYSIZE(attributes) - 3;
+        wmemcpy(attributes, cfg.dirAttr, dirLength);
+        length = dirLength;
+    }
+    if (eSystem & fileAttr) attributes[length++] = 'S';
+    if (eHidden & fileAttr) attributes[length++] = 'H';
+    if (eReadOnly & fileAttr) attributes[length++] = 'R';
+    out.WriteRight(attributes, length, 4);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Path is split once, directory, file name and name are slices of it.
+
+void OutputFormat::Write(const ReportCfg& cfg, const Ntfs::JournalRecord& jRec, OutputWriter& out) const
+{
+    const wchar_t* pPath = jRec.m_filename.c_str();
+    const size_t pathLength = jRec.m_filename.length();
+    size_t nameStart = 0;       // after last slash
+    size_t nameEnd = 0;         // last dot of file name, else end of path
+    if (m_splitPath)
+    {
+        nameStart = jRec.m_filename.find_last_of(cfg.slash) + 1;
+        size_t dotPos = jRec.m_filename.find_last_of('.');
+        nameEnd = (dotPos != std::wstring::npos && dotPos >= nameStart) ? dotPos : pathLength;
+    }
+
+    wchar_t str[100];
+    for (size_t opIdx = 0; opIdx < m_ops.size(); opIdx++)
+    {
+        const Op& op = m_ops[opIdx];
+        const size_t width = op.width > 0 ? op.width : 0;
+        switch (op.type)
+        {
+        case eOpLiteral:
+            out.Write(m_literals.c_str() + op.offset, op.length);
+            break;
+        case eOpAttribute:
+            WriteAttributes(cfg, jRec.m_fileAttr, out);
+            break;
+        case eOpTime:
+        {
+            size_t length;
+            const wchar_t* pTime = cfg.timeFormatter.Format(jRec.m_timestamp.QuadPart, length);
+            out.WriteLeft(pTime, length, width);
+        }
+        break;
+        case eOpSize:
+            out.Write(LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%*lld", op.width, jRec.m_length.QuadPart));
+            break;
+        case eOpReason:
+        {
+            const std::wstring& reasonStr = cfg.reasonNames.Get(jRec.m_reason, true);
+            out.WriteLeft(reasonStr.c_str(), reasonStr.length(), width);
+        }
+        break;
+        case eOpPath:           // path = directory + name
+            out.WriteLeft(pPath, pathLength, width);
+            break;
+        case eOpDirectory:
+            out.WriteLeft(pPath, nameStart != 0 ? nameStart - 1 : 0, width);
+            break;
+        case eOpFileName:       // filename = name + ext
+            out.WriteLeft(pPath + nameStart, pathLength - nameStart, width);
+            break;
+        case eOpName:
+            out.WriteLeft(pPath + nameStart, nameEnd - nameStart, width);
+            break;
+        case eOpExtension:
+        {
+            size_t dotPos = jRec.m_filename.find_last_of('.');
+            size_t extStart = (dotPos != std::wstring::npos) ? dotPos + 1 : pathLength;
+            out.WriteLeft(pPath + extStart, pathLength - extStart, width);
+        }
+        break;
+        case eOpRanges:         // changed byte ranges, offset+length;...
+            m_rangesStr.clear();
+            for (size_t idx = 0; idx < jRec.m_extents.size(); idx++)
+            {
+                if (idx != 0)
+                    m_rangesStr += L";";
+                swprintf_s(str, ARRAYSIZE(str), L"%lld+%lld",
+                    jRec.m_extents[idx].Offset, jRec.m_extents[idx].Length);
+                m_rangesStr += str;
+            }
+            out.WriteLeft(m_rangesStr.c_str(), m_rangesStr.length(), width);
+            break;
+        }
+    }
+
+#ifndef BACKSLASH_SPECIAL
+    if (m_newLine)
+        out.NewLine();
+#endif
+}
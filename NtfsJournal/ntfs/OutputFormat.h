@@ -0,0 +1,60 @@
+// ------------------------------------------------------------------------------------------------
+// Output format (-F) compiled once into a list of literal and field operations.
+// Each record only runs the operations, the format string is never parsed again and
+// path fields are written as slices of the full path, split once per record.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "ntfs.h"
+#include "OutputWriter.h"
+
+#include <string>
+#include <vector>
+
+struct ReportCfg;
+
+class OutputFormat
+{
+public:
+    OutputFormat(void);
+
+    // Parse format using cfg fmtChr, empty if cfg has no outputFmt.
+    void Compile(const ReportCfg& cfg);
+
+    // ReportField bits of the fields used by format.
+    DWORD GetFields() const
+    { return m_fields; }
+
+    // Run operations on record, output stage only (shares scratch strings).
+    void Write(const ReportCfg& cfg, const Ntfs::JournalRecord& jRec, OutputWriter& out) const;
+
+    // Attribute letters right aligned in 4 characters, shared with report columns.
+    static void WriteAttributes(const ReportCfg& cfg, DWORD fileAttr, OutputWriter& out);
+
+private:
+    enum OpType
+    {
+        eOpLiteral,         // m_literals[offset, offset+length)
+        eOpAttribute, eOpTime, eOpSize, eOpReason,
+        eOpPath, eOpDirectory, eOpFileName, eOpName, eOpExtension, eOpRanges
+    };
+
+    struct Op
+    {
+        BYTE    type;
+        int     width;          // pad field with spaces
+        DWORD   offset;         // literal
+        DWORD   length;
+    };
+
+    void AddLiteral(const wchar_t* pStr, size_t length);
+    void AddField(OpType type, long width);
+
+    std::vector<Op>         m_ops;
+    std::wstring            m_literals;
+    DWORD                   m_fields;           // ReportField bits
+    bool                    m_splitPath;        // some field is a slice of the path
+    bool                    m_newLine;          // false if format ends with a lone fmtChr
+    mutable std::wstring    m_rangesStr;
+};
@@ -0,0 +1,189 @@
+// ------------------------------------------------------------------------------------------------
+// Buffered report output to stdout (or any handle).
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+
+#include "OutputWriter.h"
+#include "winerrhandlers.h"
+
+// ------------------------------------------------------------------------------------------------
+OutputWriter::OutputWriter(void) :
+    m_outHnd(INVALID_HANDLE_VALUE),
+    m_encoding(eUtf8),
+    m_isConsole(false),
+    m_buffer(sBufferSize),
+    m_used(0),
+    m_bytesWritten(0),
+    m_writeCount(0),
+    m_failed(false)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+OutputWriter::~OutputWriter(void)
+{
+    Flush();
+}
+
+// ------------------------------------------------------------------------------------------------
+void OutputWriter::Open(HANDLE outHnd, Encoding encoding)
+{
+    Flush();
+    m_outHnd = outHnd;
+
+    // Console takes UTF-16 as is, whatever its code page.
+    DWORD mode;
+    m_isConsole = (GetFileType(outHnd) == FILE_TYPE_CHAR && GetConsoleMode(outHnd, &mode));
+    m_encoding = m_isConsole ? eUtf16 : encoding;
+
+    if (m_encoding == eUtf16 && !m_isConsole)
+    {
+        m_buffer[m_used++] = 0xff;
+        m_buffer[m_used++] = 0xfe;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void OutputWriter::Flush()
+{
+    if (m_used == 0 || m_outHnd == INVALID_HANDLE_VALUE || m_failed)
+    {
+        m_used = 0;
+        return;
+    }
+
+    // Partial writes continue with the rest, console takes the buffer in chunks.
+    const BYTE* pData = &m_buffer[0];
+    size_t remain = m_used;
+    m_used = 0;
+    while (remain != 0)
+    {
+        DWORD written = 0;
+        BOOL ok;
+        if (m_isConsole)
+        {
+            DWORD chars = (DWORD)min(remain / sizeof(wchar_t), sMaxConsoleChars);
+            ok = WriteConsoleW(m_outHnd, pData, chars, &written, NULL);
+            written *= sizeof(wchar_t);
+        }
+        else
+        {
+            ok = WriteFile(m_outHnd, pData, (DWORD)remain, &written, NULL);
+        }
+        m_writeCount++;
+
+        if (!ok || written == 0)
+        {
+            m_errorMsg = WinErrHandlers::LastErrorMsg(ok ? ERROR_WRITE_FAULT : 0);
+            m_failed = true;
+            return;
+        }
+        m_bytesWritten += written;
+        pData += written;
+        remain -= written;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Encode into buffer, flushing whenever less than one character of room is left.
+void OutputWriter::Write(const wchar_t* pStr, size_t length)
+{
+    const wchar_t* pEnd = pStr + length;
+    while (pStr < pEnd)
+    {
+        if (m_used + sMaxCharBytes > m_buffer.size())
+            Flush();
+
+        BYTE* pOut = &m_buffer[m_used];
+        BYTE* pOutEnd = &m_buffer[0] + m_buffer.size() - sMaxCharBytes;
+
+        if (m_encoding == eUtf16)
+        {
+            for (; pStr < pEnd && pOut <= pOutEnd; pStr++)
+            {
+                *pOut++ = (BYTE)*pStr;
+                *pOut++ = (BYTE)(*pStr >> 8);
+            }
+        }
+        else
+        {
+            for (; pStr < pEnd && pOut <= pOutEnd; pStr++)
+            {
+                DWORD chr = (WORD)*pStr;
+                if (chr < 0x80)
+                {
+                    *pOut++ = (BYTE)chr;
+                    continue;
+                }
+
+                if (chr < 0x800)
+                {
+                    *pOut++ = (BYTE)(0xc0 | (chr >> 6));
+                }
+                else
+                {
+                    // Surrogate pair to one code point, a lone surrogate is encoded as is.
+                    if (chr >= 0xd800 && chr < 0xdc00 && pStr + 1 < pEnd
+                        && (WORD)pStr[1] >= 0xdc00 && (WORD)pStr[1] < 0xe000)
+                    {
+                        chr = 0x10000 + ((chr - 0xd800) << 10) + ((WORD)*++pStr - 0xdc00);
+                        *pOut++ = (BYTE)(0xf0 | (chr >> 18));
+                        *pOut++ = (BYTE)(0x80 | ((chr >> 12) & 0x3f));
+                    }
+                    else
+                    {
+                        *pOut++ = (BYTE)(0xe0 | (chr >> 12));
+                    }
+                    *pOut++ = (BYTE)(0x80 | ((chr >> 6) & 0x3f));
+                }
+                *pOut++ = (BYTE)(0x80 | (chr & 0x3f));
+            }
+        }
+
+        m_used = pOut - &m_buffer[0];
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void OutputWriter::WriteSpaces(size_t count)
+{
+    static const wchar_t sSpaces[] = L"                                ";
+    const size_t maxSpaces = ARRAYSIZE(sSpaces) - 1;
+    for (; count > maxSpaces; count -= maxSpaces)
+        Write(sSpaces, maxSpaces);
+    Write(sSpaces, count);
+}
+
+// ------------------------------------------------------------------------------------------------
+void OutputWriter::WriteRight(const wchar_t* pStr, size_t length, size_t width)
+{
+    if (length < width)
+        WriteSpaces(width - length);
+    Write(pStr, length);
+}
+
+// ------------------------------------------------------------------------------------------------
+void OutputWriter::WriteLeft(const wchar_t* pStr, size_t length, size_t width)
+{
+    Write(pStr, length);
+    if (length < width)
+        WriteSpaces(width - length);
+}
+
+// ------------------------------------------------------------------------------------------------
+void OutputWriter::WriteNumber(LONGLONG value, size_t width)
+{
+    wchar_t digits[24];
+    wchar_t* pDigit = digits + ARRAYSIZE(digits);
+    ULONGLONG magnitude = (value < 0) ? 0 - (ULONGLONG)value : (ULONGLONG)value;
+    do
+    {
+        *--pDigit = (wchar_t)(L'0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0)
+        *--pDigit = L'-';
+
+    WriteRight(pDigit, digits + ARRAYSIZE(digits) - pDigit, width);
+}
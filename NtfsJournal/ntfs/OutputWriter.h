@@ -0,0 +1,76 @@
+// ------------------------------------------------------------------------------------------------
+// Buffered report output to stdout (or any handle), replaces per field std::wcout.
+// Text is encoded straight into one large buffer, UTF-8 or UTF-16LE when redirected to a
+// file or pipe, native UTF-16 written with WriteConsoleW on a console. The buffer is
+// written when full or on Flush, never per line, in one call (console in 16K chunks).
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+class OutputWriter
+{
+public:
+    enum Encoding { eUtf8, eUtf16 };
+
+    OutputWriter(void);
+    ~OutputWriter(void);
+
+    // Start writing to handle, UTF-16 output to a file starts with a byte order mark.
+    void Open(HANDLE outHnd, Encoding encoding = eUtf8);
+
+    void Write(const wchar_t* pStr, size_t length);
+    void Write(const wchar_t* pStr)
+    { Write(pStr, wcslen(pStr)); }
+    void Write(const std::wstring& str)
+    { Write(str.c_str(), str.length()); }
+    void Write(wchar_t chr)
+    { Write(&chr, 1); }
+
+    // Pad with spaces to width, right aligned (numbers, attributes) or left aligned (fields).
+    void WriteRight(const wchar_t* pStr, size_t length, size_t width);
+    void WriteLeft(const wchar_t* pStr, size_t length, size_t width);
+    void WriteNumber(LONGLONG value, size_t width = 0);
+    void NewLine()
+    { Write(L"\r\n", 2); }
+
+    // Write buffered text, call before other output (stderr logs) should follow it.
+    // After a failed write the rest of the output is dropped, see HasFailed.
+    void Flush();
+
+    bool HasFailed() const
+    { return m_failed; }
+    std::wstring GetLastErrorMsg() const
+    { return m_errorMsg; }
+
+    bool IsConsole() const
+    { return m_isConsole; }
+
+    ULONGLONG GetBytesWritten() const
+    { return m_bytesWritten; }
+    ULONGLONG GetWriteCount() const
+    { return m_writeCount; }
+
+private:
+    OutputWriter(const OutputWriter&);
+    OutputWriter& operator=(const OutputWriter&);
+
+    void WriteSpaces(size_t count);
+
+    static const size_t sBufferSize = 256 * 1024;
+    static const size_t sMaxCharBytes = 4;      // worst case bytes of one encoded character
+    static const size_t sMaxConsoleChars = 16 * 1024;   // larger console writes may fail
+
+    HANDLE              m_outHnd;
+    Encoding            m_encoding;
+    bool                m_isConsole;
+    std::vector<BYTE>   m_buffer;
+    size_t              m_used;
+    ULONGLONG           m_bytesWritten;
+    ULONGLONG           m_writeCount;
+    bool                m_failed;
+    std::wstring        m_errorMsg;
+};
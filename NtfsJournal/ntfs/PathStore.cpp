@@ -0,0 +1,624 @@
+// ------------------------------------------------------------------------------------------------
+// Compact path cache, paths are interned as a tree of name nodes.
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+
+#include "PathStore.h"
+#include "ntfstypes.h"
+#include "Hnd.h"
+#include "winerrhandlers.h"
+
+static const wchar_t sSlash = L'\\';
+static const size_t sInitialSlots = 1024;   // power of 2
+
+// Saved store, tables follow header in this order, each naturally aligned.
+//   IdSlot[idSlotCount], Node[nodeCount], DWORD[childSlotCount], wchar_t[nameCount]
+static const char sStoreMagic[8] = { 'N', 'T', 'J', 'P', 'A', 'T', 'H', 0 };
+static const DWORD sStoreVersion = 1;
+
+struct StoreFileHeader
+{
+    char            magic[8];       // sStoreMagic
+    DWORD           version;        // sStoreVersion
+    DWORD           charSize;       // sizeof(wchar_t) of writer
+    ULONGLONG       volumeSerial;
+    ULONGLONG       journalId;
+    USN             lastUsn;
+    ULONGLONG       idSlotCount;
+    ULONGLONG       idCount;
+    ULONGLONG       nodeCount;
+    ULONGLONG       childSlotCount;
+    ULONGLONG       childCount;
+    ULONGLONG       nameCount;
+};
+
+const DWORD PathStore::sNoNode;
+
+// ------------------------------------------------------------------------------------------------
+PathStore::PathStore(void) :
+    m_idCount(0),
+    m_childCount(0),
+    m_loadedNodes(0),
+    m_renameNode(sNoNode)
+{
+    Clear();
+}
+
+// ------------------------------------------------------------------------------------------------
+PathStore::~PathStore(void)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+void PathStore::SaveLastError(DWORD error) const
+{
+    m_errorMsg = WinErrHandlers::LastErrorMsg(error);
+}
+
+// ------------------------------------------------------------------------------------------------
+void PathStore::Clear()
+{
+    Node root = { sNoNode, 0, 0 };
+    m_nodes.assign(1, root);
+    m_names.clear();
+
+    IdSlot empty;
+    empty.node = sNoNode;
+    empty.sequence = 0;
+    empty.reserved = 0;
+    m_idSlots.assign(sInitialSlots, empty);
+    m_idCount = 0;
+
+    m_childSlots.assign(sInitialSlots, sNoNode);
+    m_childCount = 0;
+    m_loadedNodes = 0;
+    m_renameNode = sNoNode;
+}
+
+// ------------------------------------------------------------------------------------------------
+size_t PathStore::GetMemoryBytes() const
+{
+    return m_nodes.capacity() * sizeof(Node)
+        + m_names.capacity() * sizeof(wchar_t)
+        + m_idSlots.capacity() * sizeof(IdSlot)
+        + m_childSlots.capacity() * sizeof(DWORD);
+}
+
+// ------------------------------------------------------------------------------------------------
+// NTFS ids are keyed by MFT record number so a reused record replaces its old entry.
+FileRef PathStore::GetKey(const FileRef& fileId, WORD& sequence)
+{
+    if (!fileId.Is64())
+    {
+        sequence = 0;
+        return fileId;
+    }
+
+    sequence = (WORD)(fileId.low >> 48);
+    return FileRef(fileId.low & sMftRecordMask);
+}
+
+// ------------------------------------------------------------------------------------------------
+size_t PathStore::Hash(const FileRef& key)
+{
+    return FileRefHash()(key);
+}
+
+// ------------------------------------------------------------------------------------------------
+// FNV-1a of parent and name.
+size_t PathStore::Hash(DWORD parent, const wchar_t* pName, DWORD nameLength)
+{
+    ULONGLONG hash = 0xcbf29ce484222325ULL ^ parent;
+    for (DWORD idx = 0; idx < nameLength; idx++)
+    {
+        hash ^= (WORD)pName[idx];
+        hash *= 0x100000001b3ULL;
+    }
+    return (size_t)(hash ^ (hash >> 32));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return slot holding key, or the empty slot where it belongs.
+size_t PathStore::FindIdSlot(const FileRef& key) const
+{
+    size_t mask = m_idSlots.size() - 1;
+    size_t slot = Hash(key) & mask;
+    while (m_idSlots[slot].node != sNoNode && m_idSlots[slot].key != key)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PathStore::GrowIds()
+{
+    std::vector<IdSlot> oldSlots;
+    oldSlots.swap(m_idSlots);
+
+    IdSlot empty;
+    empty.node = sNoNode;
+    empty.sequence = 0;
+    empty.reserved = 0;
+    m_idSlots.assign(oldSlots.size() * 2, empty);
+
+    for (size_t idx = 0; idx < oldSlots.size(); idx++)
+    {
+        if (oldSlots[idx].node != sNoNode)
+            m_idSlots[FindIdSlot(oldSlots[idx].key)] = oldSlots[idx];
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void PathStore::GrowChildren()
+{
+    std::vector<DWORD> oldSlots;
+    oldSlots.swap(m_childSlots);
+    m_childSlots.assign(oldSlots.size() * 2, sNoNode);
+
+    size_t mask = m_childSlots.size() - 1;
+    for (size_t idx = 0; idx < oldSlots.size(); idx++)
+    {
+        DWORD nodeIdx = oldSlots[idx];
+        if (nodeIdx == sNoNode)
+            continue;
+
+        const Node& node = m_nodes[nodeIdx];
+        size_t slot = Hash(node.parent, &m_names[node.nameOffset], node.nameLength) & mask;
+        while (m_childSlots[slot] != sNoNode)
+            slot = (slot + 1) & mask;
+        m_childSlots[slot] = nodeIdx;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return slot holding node of name below parent, or the empty slot where it belongs.
+size_t PathStore::FindChildSlot(DWORD parent, const wchar_t* pName, DWORD nameLength) const
+{
+    size_t mask = m_childSlots.size() - 1;
+    size_t slot = Hash(parent, pName, nameLength) & mask;
+    while (m_childSlots[slot] != sNoNode)
+    {
+        const Node& node = m_nodes[m_childSlots[slot]];
+        if (node.parent == parent && node.nameLength == nameLength
+            && wmemcmp(&m_names[node.nameOffset], pName, nameLength) == 0)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return node of name below parent, adding it if new.
+DWORD PathStore::InternChild(DWORD parent, const wchar_t* pName, DWORD nameLength)
+{
+    size_t slot = FindChildSlot(parent, pName, nameLength);
+    if (m_childSlots[slot] != sNoNode)
+        return m_childSlots[slot];
+
+    Node node;
+    node.parent = parent;
+    node.nameOffset = (DWORD)m_names.size();
+    node.nameLength = nameLength;
+    m_names.insert(m_names.end(), pName, pName + nameLength);
+
+    DWORD nodeIdx = (DWORD)m_nodes.size();
+    m_nodes.push_back(node);
+    m_childSlots[slot] = nodeIdx;
+
+    // Keep load under 1/2 so probes stay short.
+    if (++m_childCount * 2 > m_childSlots.size())
+        GrowChildren();
+    return nodeIdx;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PathStore::Add(const FileRef& fileId, const std::wstring& fullPath)
+{
+    DWORD nodeIdx = sRootNode;
+    const wchar_t* pPath = fullPath.c_str();
+    const wchar_t* pEnd = pPath + fullPath.length();
+
+    while (pPath < pEnd)
+    {
+        const wchar_t* pSlash = wmemchr(pPath, sSlash, pEnd - pPath);
+        if (pSlash == NULL)
+            pSlash = pEnd;
+        if (pSlash != pPath)
+            nodeIdx = InternChild(nodeIdx, pPath, (DWORD)(pSlash - pPath));
+        pPath = pSlash + 1;
+    }
+
+    SetIdNode(fileId, nodeIdx);
+}
+
+// ------------------------------------------------------------------------------------------------
+void PathStore::SetIdNode(const FileRef& fileId, DWORD nodeIdx)
+{
+    WORD sequence;
+    FileRef key = GetKey(fileId, sequence);
+    size_t slot = FindIdSlot(key);
+    if (m_idSlots[slot].node == sNoNode)
+    {
+        m_idSlots[slot].key = key;
+        m_idCount++;
+    }
+    m_idSlots[slot].node = nodeIdx;
+    m_idSlots[slot].sequence = sequence;
+
+    if (m_idCount * 2 > m_idSlots.size())
+        GrowIds();
+}
+
+// ------------------------------------------------------------------------------------------------
+bool PathStore::GetPath(const FileRef& fileId, std::wstring& path) const
+{
+    DWORD leafIdx = FindNode(fileId);
+    if (leafIdx == sNoNode)
+        return false;
+
+    // Collect nodes leaf to root, then join them root first.
+    const Node* chain[sMaxDepth];
+    unsigned depth = 0;
+    size_t length = 0;
+    for (DWORD nodeIdx = leafIdx; nodeIdx != sRootNode && depth < sMaxDepth; depth++)
+    {
+        const Node& node = m_nodes[nodeIdx];
+        chain[depth] = &node;
+        length += node.nameLength + 1;
+        nodeIdx = node.parent;
+    }
+
+    path.clear();
+    path.reserve(length);
+    while (depth != 0)
+    {
+        const Node& node = *chain[--depth];
+        path += sSlash;
+        path.append(&m_names[node.nameOffset], node.nameLength);
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return node of file id, sNoNode if not stored or sequence differs.
+DWORD PathStore::FindNode(const FileRef& fileId) const
+{
+    WORD sequence;
+    FileRef key = GetKey(fileId, sequence);
+    const IdSlot& idSlot = m_idSlots[FindIdSlot(key)];
+    return (idSlot.sequence == sequence) ? idSlot.node : sNoNode;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool PathStore::HasFile(const FileRef& fileId) const
+{
+    return FindNode(fileId) != sNoNode;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Linear probing delete, entry at slot may move back into hole unless its home
+// lies cyclically in (hole, slot].
+static bool CanMoveTo(size_t hole, size_t slot, size_t home)
+{
+    if (hole <= slot)
+        return home <= hole || home > slot;
+    return home <= hole && home > slot;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PathStore::RemoveIdSlot(size_t hole)
+{
+    size_t mask = m_idSlots.size() - 1;
+    for (size_t slot = (hole + 1) & mask; m_idSlots[slot].node != sNoNode; slot = (slot + 1) & mask)
+    {
+        if (CanMoveTo(hole, slot, Hash(m_idSlots[slot].key) & mask))
+        {
+            m_idSlots[hole] = m_idSlots[slot];
+            hole = slot;
+        }
+    }
+
+    m_idSlots[hole].node = sNoNode;
+    m_idSlots[hole].sequence = 0;
+    m_idCount--;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PathStore::RemoveChildSlot(DWORD nodeIdx)
+{
+    const Node& node = m_nodes[nodeIdx];
+    size_t mask = m_childSlots.size() - 1;
+    size_t hole = Hash(node.parent, &m_names[node.nameOffset], node.nameLength) & mask;
+    while (m_childSlots[hole] != nodeIdx)
+    {
+        if (m_childSlots[hole] == sNoNode)
+            return;     // detached by an earlier rename
+        hole = (hole + 1) & mask;
+    }
+
+    for (size_t slot = (hole + 1) & mask; m_childSlots[slot] != sNoNode; slot = (slot + 1) & mask)
+    {
+        const Node& other = m_nodes[m_childSlots[slot]];
+        if (CanMoveTo(hole, slot, Hash(other.parent, &m_names[other.nameOffset], other.nameLength) & mask))
+        {
+            m_childSlots[hole] = m_childSlots[slot];
+            hole = slot;
+        }
+    }
+
+    m_childSlots[hole] = sNoNode;
+    m_childCount--;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PathStore::Remove(const FileRef& fileId)
+{
+    WORD sequence;
+    size_t slot = FindIdSlot(GetKey(fileId, sequence));
+    if (m_idSlots[slot].node != sNoNode)
+        RemoveIdSlot(slot);
+}
+
+// ------------------------------------------------------------------------------------------------
+// True if node is treeIdx or lies below it, chains deeper than sMaxDepth count as below.
+bool PathStore::IsBelow(DWORD nodeIdx, DWORD treeIdx) const
+{
+    unsigned depth = 0;
+    for (; nodeIdx != sRootNode; nodeIdx = m_nodes[nodeIdx].parent)
+    {
+        if (nodeIdx == treeIdx || ++depth == sMaxDepth)
+            return true;
+    }
+    return treeIdx == sRootNode;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Location of directory is unknown, detach its node and forget every id at or below it.
+// Slots are checked again after a delete, a later entry may have moved back into them.
+void PathStore::RemoveTree(DWORD treeIdx)
+{
+    RemoveChildSlot(treeIdx);
+    for (size_t slot = 0; slot < m_idSlots.size(); )
+    {
+        if (m_idSlots[slot].node != sNoNode && IsBelow(m_idSlots[slot].node, treeIdx))
+            RemoveIdSlot(slot);
+        else
+            slot++;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+bool PathStore::RenameOld(const FileRef& fileId, const FileRef& parentId, const std::wstring& name, bool loadedOnly)
+{
+    m_renameId = fileId;
+    m_renameNode = FindNode(fileId);
+    if (m_renameNode == sNoNode)
+    {
+        DWORD parentIdx = FindNode(parentId);
+        if (parentIdx == sNoNode)
+            return false;
+
+        // Empty slot when nothing is stored below the directory.
+        m_renameNode = m_childSlots[FindChildSlot(parentIdx, name.c_str(), (DWORD)name.length())];
+    }
+
+    if (loadedOnly && m_renameNode >= m_loadedNodes)
+        m_renameNode = sNoNode;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Directory renamed or moved. Its node is repointed, so every path interned below it
+// resolves to the new location without touching the descendants.
+bool PathStore::RenameNew(const FileRef& fileId, const FileRef& parentId, const std::wstring& name, bool loadedOnly)
+{
+    // Without the old name record (scan started between the two) only a stored id is found.
+    DWORD nodeIdx = (m_renameNode != sNoNode && m_renameId == fileId) ? m_renameNode : FindNode(fileId);
+    m_renameNode = sNoNode;
+    if (nodeIdx == sNoNode || nodeIdx == sRootNode || (loadedOnly && nodeIdx >= m_loadedNodes))
+        return false;
+
+    // New location unknown, or a move below itself.
+    DWORD parentIdx = FindNode(parentId);
+    if (parentIdx == sNoNode || name.empty() || IsBelow(parentIdx, nodeIdx))
+    {
+        RemoveTree(nodeIdx);
+        return false;
+    }
+
+    RemoveChildSlot(nodeIdx);
+
+    Node& node = m_nodes[nodeIdx];
+    DWORD nameLength = (DWORD)name.length();
+    if (nameLength > node.nameLength)
+    {
+        node.nameOffset = (DWORD)m_names.size();
+        m_names.insert(m_names.end(), name.begin(), name.end());
+    }
+    else
+    {
+        wmemcpy(&m_names[node.nameOffset], name.c_str(), nameLength);
+    }
+    node.parent = parentIdx;
+    node.nameLength = nameLength;
+
+    // A stale node already holding the new name is detached, new children intern below ours.
+    size_t slot = FindChildSlot(parentIdx, name.c_str(), nameLength);
+    bool isNew = (m_childSlots[slot] == sNoNode);
+    m_childSlots[slot] = nodeIdx;
+    if (isNew && ++m_childCount * 2 > m_childSlots.size())
+        GrowChildren();
+
+    // Directory is now also found by its id.
+    SetIdNode(fileId, nodeIdx);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool WriteBlock(HANDLE fileHnd, const void* pData, size_t length)
+{
+    DWORD written;
+    return length == 0
+        || (WriteFile(fileHnd, pData, (DWORD)length, &written, NULL) && written == length);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Written to a temporary file first, so a reader never sees half a store.
+bool PathStore::Save(const wchar_t* path, const CacheKey& key) const
+{
+    std::wstring tmpPath = std::wstring(path) + L".tmp";
+    Hnd fileHnd = CreateFile(tmpPath.c_str(), GENERIC_WRITE,
+        0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (!fileHnd.IsValid())
+    {
+        SaveLastError();
+        return false;
+    }
+
+    StoreFileHeader header;
+    ZeroMemory(&header, sizeof(header));
+    memcpy(header.magic, sStoreMagic, sizeof(header.magic));
+    header.version = sStoreVersion;
+    header.charSize = sizeof(wchar_t);
+    header.volumeSerial = key.volumeSerial;
+    header.journalId = key.journalId;
+    header.lastUsn = key.lastUsn;
+    header.idSlotCount = m_idSlots.size();
+    header.idCount = m_idCount;
+    header.nodeCount = m_nodes.size();
+    header.childSlotCount = m_childSlots.size();
+    header.childCount = m_childCount;
+    header.nameCount = m_names.size();
+
+    bool ok = WriteBlock(fileHnd, &header, sizeof(header))
+        && WriteBlock(fileHnd, &m_idSlots[0], m_idSlots.size() * sizeof(IdSlot))
+        && WriteBlock(fileHnd, &m_nodes[0], m_nodes.size() * sizeof(Node))
+        && WriteBlock(fileHnd, &m_childSlots[0], m_childSlots.size() * sizeof(DWORD))
+        && WriteBlock(fileHnd, m_names.empty() ? NULL : &m_names[0], m_names.size() * sizeof(wchar_t));
+    if (!ok)
+    {
+        SaveLastError();
+        fileHnd = INVALID_HANDLE_VALUE;
+        DeleteFile(tmpPath.c_str());
+        return false;
+    }
+
+    fileHnd = INVALID_HANDLE_VALUE;
+    if (!MoveFileEx(tmpPath.c_str(), path, MOVEFILE_REPLACE_EXISTING))
+    {
+        SaveLastError();
+        DeleteFile(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool PathStore::Load(const wchar_t* path, CacheKey& key)
+{
+    Hnd fileHnd = CreateFile(path, GENERIC_READ,
+        FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER fileSize;
+    if (!fileHnd.IsValid() || !GetFileSizeEx(fileHnd, &fileSize))
+    {
+        SaveLastError();
+        return false;
+    }
+    if ((ULONGLONG)fileSize.QuadPart < sizeof(StoreFileHeader) || (ULONGLONG)fileSize.QuadPart > (size_t)-1)
+    {
+        SaveLastError(ERROR_HANDLE_EOF);
+        return false;
+    }
+
+    HANDLE mapHnd = CreateFileMapping(fileHnd, NULL, PAGE_READONLY, 0, 0, NULL);
+    const BYTE* pView = (mapHnd == NULL) ? NULL : (const BYTE*)MapViewOfFile(mapHnd, FILE_MAP_READ, 0, 0, 0);
+    if (pView == NULL)
+    {
+        SaveLastError();
+        if (mapHnd != NULL)
+            CloseHandle(mapHnd);
+        return false;
+    }
+
+    const StoreFileHeader& header = *(const StoreFileHeader*)pView;
+
+    // Table sizes are taken from what is left of the file, so a damaged count can not overflow.
+    ULONGLONG remain = (ULONGLONG)fileSize.QuadPart - sizeof(header);
+    const ULONGLONG counts[] = { header.idSlotCount, header.nodeCount, header.childSlotCount, header.nameCount };
+    const ULONGLONG sizes[] = { sizeof(IdSlot), sizeof(Node), sizeof(DWORD), sizeof(wchar_t) };
+    bool ok = true;
+    for (unsigned idx = 0; idx < ARRAYSIZE(counts) && ok; idx++)
+    {
+        ok = counts[idx] <= remain / sizes[idx];
+        if (ok)
+            remain -= counts[idx] * sizes[idx];
+    }
+
+    ok = ok && remain == 0
+        && memcmp(header.magic, sStoreMagic, sizeof(header.magic)) == 0
+        && header.version == sStoreVersion
+        && header.charSize == sizeof(wchar_t)
+        && (header.idSlotCount & (header.idSlotCount - 1)) == 0 && header.idCount * 2 <= header.idSlotCount
+        && (header.childSlotCount & (header.childSlotCount - 1)) == 0 && header.childCount * 2 <= header.childSlotCount
+        && header.idSlotCount != 0 && header.childSlotCount != 0 && header.nodeCount != 0
+        && header.nodeCount < sNoNode && header.nameCount < sNoNode;
+
+    const IdSlot* pIdSlots = (const IdSlot*)(pView + sizeof(header));
+    const Node* pNodes = (const Node*)(pIdSlots + header.idSlotCount);
+    const DWORD* pChildSlots = (const DWORD*)(pNodes + header.nodeCount);
+    const wchar_t* pNames = (const wchar_t*)(pChildSlots + header.childSlotCount);
+
+    // Every index must stay inside its table, and slot counts must match the header so
+    // probes always reach an empty slot.
+    DWORD nodeCount = (DWORD)header.nodeCount;
+    ok = ok && pNodes[sRootNode].parent == sNoNode;
+    for (DWORD idx = 1; idx < nodeCount && ok; idx++)
+    {
+        ok = pNodes[idx].parent < nodeCount
+            && (ULONGLONG)pNodes[idx].nameOffset + pNodes[idx].nameLength <= header.nameCount;
+    }
+    ULONGLONG usedCount = 0;
+    for (ULONGLONG idx = 0; idx < header.idSlotCount && ok; idx++)
+    {
+        if (pIdSlots[idx].node != sNoNode)
+        {
+            ok = pIdSlots[idx].node < nodeCount;
+            usedCount++;
+        }
+    }
+    ok = ok && usedCount == header.idCount;
+    usedCount = 0;
+    for (ULONGLONG idx = 0; idx < header.childSlotCount && ok; idx++)
+    {
+        if (pChildSlots[idx] != sNoNode)
+        {
+            ok = pChildSlots[idx] < nodeCount && pChildSlots[idx] != sRootNode;
+            usedCount++;
+        }
+    }
+    ok = ok && usedCount == header.childCount;
+
+    if (ok)
+    {
+        m_idSlots.assign(pIdSlots, pIdSlots + header.idSlotCount);
+        m_nodes.assign(pNodes, pNodes + header.nodeCount);
+        m_childSlots.assign(pChildSlots, pChildSlots + header.childSlotCount);
+        m_names.assign(pNames, pNames + header.nameCount);
+        m_idCount = (size_t)header.idCount;
+        m_childCount = (size_t)header.childCount;
+        m_loadedNodes = (DWORD)header.nodeCount;
+        m_renameNode = sNoNode;
+
+        key.volumeSerial = header.volumeSerial;
+        key.journalId = header.journalId;
+        key.lastUsn = header.lastUsn;
+    }
+    else
+    {
+        m_errorMsg = L"Path cache file is invalid or from another version";
+    }
+
+    UnmapViewOfFile(pView);
+    CloseHandle(mapHnd);
+    return ok;
+}
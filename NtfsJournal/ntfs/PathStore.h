@@ -0,0 +1,125 @@
+// ------------------------------------------------------------------------------------------------
+// Compact path cache, paths are interned as a tree of name nodes.
+// Each node holds its parent node and an offset into one name arena, so a shared directory
+// prefix is stored once however many files live below it. File ids map to nodes through an
+// open addressing index keyed by MFT record number, with the sequence number kept in the slot
+// so a reused record never returns the old path. Full paths are built on demand.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "FileRef.h"
+
+class PathStore
+{
+public:
+    PathStore(void);
+    ~PathStore(void);
+
+    void Clear();
+
+    // Identifies journal state a saved store is valid for.
+    struct CacheKey
+    {
+        ULONGLONG   volumeSerial;
+        ULONGLONG   journalId;
+        USN         lastUsn;        // journal read up to (excluding) this usn
+    };
+
+    // Persist store so next run starts warm. File is versioned and its tables are laid out
+    // aligned so Load maps the file and copies each table with one move.
+    bool Save(const wchar_t* path, const CacheKey& key) const;
+    bool Load(const wchar_t* path, CacheKey& key);
+
+    // Add file id with its full volume path (\dir\name).
+    void Add(const FileRef& fileId, const std::wstring& fullPath);
+
+    // Build full path of file id into path, reusing its buffer. Return false if not stored.
+    bool GetPath(const FileRef& fileId, std::wstring& path) const;
+
+    // True if file id (with same sequence) is stored.
+    bool HasFile(const FileRef& fileId) const;
+
+    // Old name record of a directory rename. Find the directory node by its id, or by old parent
+    // and old name since a directory which is only a prefix of stored paths has no id.
+    // Return false if neither directory nor old parent is stored, its paths can not be found.
+    // With loadedOnly, a node added since Load is left alone, its path is already newer.
+    bool RenameOld(const FileRef& fileId, const FileRef& parentId, const std::wstring& name, bool loadedOnly);
+
+    // New name record, move node found by RenameOld below stored parent with new name. Paths
+    // below it follow without being touched. If the new parent is not stored the directory and
+    // every path below it is dropped. Return false if nothing was moved.
+    bool RenameNew(const FileRef& fileId, const FileRef& parentId, const std::wstring& name, bool loadedOnly);
+
+    // True if store holds nodes read by Load.
+    bool HasLoaded() const
+    { return m_loadedNodes != 0; }
+
+    void Remove(const FileRef& fileId);
+
+    size_t GetFileCount() const
+    { return m_idCount; }
+    size_t GetNodeCount() const
+    { return m_nodes.size(); }
+    size_t GetMemoryBytes() const;
+
+    std::wstring GetLastErrorMsg() const
+    { return m_errorMsg; }
+
+private:
+    static const DWORD sNoNode = 0xffffffff;
+    static const DWORD sRootNode = 0;
+    static const unsigned sMaxDepth = 256;
+
+    struct Node
+    {
+        DWORD       parent;         // node index, sNoNode for root
+        DWORD       nameOffset;     // into m_names
+        DWORD       nameLength;     // characters
+    };
+
+    struct IdSlot
+    {
+        FileRef     key;            // MFT record number (64 bit ids) or full 128 bit id
+        DWORD       node;           // sNoNode if slot empty
+        WORD        sequence;       // sequence of 64 bit id
+        WORD        reserved;       // zero, so saved slots carry no uninitialized padding
+    };
+
+    static FileRef GetKey(const FileRef& fileId, WORD& sequence);
+    static size_t Hash(const FileRef& key);
+    static size_t Hash(DWORD parent, const wchar_t* pName, DWORD nameLength);
+
+    size_t FindIdSlot(const FileRef& key) const;
+    DWORD FindNode(const FileRef& fileId) const;
+    size_t FindChildSlot(DWORD parent, const wchar_t* pName, DWORD nameLength) const;
+    DWORD InternChild(DWORD parent, const wchar_t* pName, DWORD nameLength);
+    void SetIdNode(const FileRef& fileId, DWORD nodeIdx);
+    bool IsBelow(DWORD nodeIdx, DWORD treeIdx) const;
+    void RemoveIdSlot(size_t slot);
+    void RemoveChildSlot(DWORD nodeIdx);
+    void RemoveTree(DWORD treeIdx);
+    void GrowIds();
+    void GrowChildren();
+
+    void SaveLastError(DWORD error=0) const;
+
+private:
+    std::vector<Node>       m_nodes;
+    std::vector<wchar_t>    m_names;        // name arena
+
+    std::vector<IdSlot>     m_idSlots;      // file id -> node, power of 2 size
+    size_t                  m_idCount;
+
+    std::vector<DWORD>      m_childSlots;   // (parent, name) -> node, power of 2 size
+    size_t                  m_childCount;
+
+    DWORD                   m_loadedNodes;  // nodes below this index came from Load
+
+    FileRef                 m_renameId;     // directory between its old and new name records
+    DWORD                   m_renameNode;
+    mutable std::wstring    m_errorMsg;
+};
@@ -0,0 +1,69 @@
+// ------------------------------------------------------------------------------------------------
+// Reason strings interned by reason bits.
+// ------------------------------------------------------------------------------------------------
+
+#include "ReasonNames.h"
+#include "ntfs.h"
+
+#include <algorithm>
+
+// ------------------------------------------------------------------------------------------------
+ReasonNames::ReasonNames(void) :
+    m_pLast(NULL)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+// Copy (report settings copied to each session) must not point into other map.
+
+ReasonNames::ReasonNames(const ReasonNames& other) :
+    m_entries(other.m_entries),
+    m_pLast(NULL)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+ReasonNames& ReasonNames::operator=(const ReasonNames& other)
+{
+    m_entries = other.m_entries;
+    m_pLast = NULL;
+    return *this;
+}
+
+// ------------------------------------------------------------------------------------------------
+const std::wstring& ReasonNames::Get(DWORD reason, bool hideDataChange)
+{
+    if (hideDataChange && (reason & 0xf00) != 0)
+        reason &= ~0xff;    // suppress the extend and overwrite if Create or Delete.
+
+    if (m_pLast == NULL || m_pLast->reason != reason)
+    {
+        // Pointers to map values stay valid as it grows.
+        std::pair<EntryMap::iterator, bool> result = m_entries.insert(EntryMap::value_type(reason, Entry()));
+        m_pLast = &result.first->second;
+        if (result.second)
+        {
+            m_pLast->reason = reason;
+            m_pLast->count = 0;
+            Ntfs::GetReasonString(reason, m_pLast->name);
+        }
+    }
+
+    m_pLast->count++;
+    return m_pLast->name;
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool IsMoreOften(const ReasonNames::Entry* pLhs, const ReasonNames::Entry* pRhs)
+{
+    return pLhs->count > pRhs->count;
+}
+
+// ------------------------------------------------------------------------------------------------
+void ReasonNames::GetEntries(EntryList& entries) const
+{
+    entries.clear();
+    for (EntryMap::const_iterator iter = m_entries.begin(); iter != m_entries.end(); iter++)
+        entries.push_back(&iter->second);
+    std::stable_sort(entries.begin(), entries.end(), IsMoreOften);
+}
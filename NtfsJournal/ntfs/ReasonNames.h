@@ -0,0 +1,45 @@
+// ------------------------------------------------------------------------------------------------
+// Reason strings interned by reason bits.
+// Journals only use a few hundred reason combinations, each is converted to text the first
+// time it is seen and later records copy the cached string. Counts of each combination
+// are kept, for a summary of reported changes.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ReasonNames
+{
+public:
+    ReasonNames(void);
+    ReasonNames(const ReasonNames& other);
+    ReasonNames& operator=(const ReasonNames& other);
+
+    // Reason string, hideDataChange drops data overwrite/extend/truncate bits of records
+    // which also create or delete (as -F %r).
+    const std::wstring& Get(DWORD reason, bool hideDataChange = false);
+
+    struct Entry
+    {
+        DWORD           reason;
+        ULONGLONG       count;
+        std::wstring    name;
+    };
+    typedef std::vector<const Entry*> EntryList;
+
+    size_t GetCount() const
+    { return m_entries.size(); }
+
+    // Combinations most often reported first.
+    void GetEntries(EntryList& entries) const;
+
+private:
+    typedef std::unordered_map<DWORD, Entry> EntryMap;
+
+    EntryMap        m_entries;
+    Entry*          m_pLast;        // consecutive records often share reason
+};
@@ -0,0 +1,114 @@
+// ------------------------------------------------------------------------------------------------
+// Records kept by a session until they are reported.
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+
+#include "RecordStore.h"
+
+// ------------------------------------------------------------------------------------------------
+RecordStore::RecordStore(void)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+RecordStore::~RecordStore(void)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+void RecordStore::Clear()
+{
+    m_records.clear();
+    m_extents.clear();
+    m_names.Clear();
+}
+
+// ------------------------------------------------------------------------------------------------
+size_t RecordStore::GetMemoryBytes() const
+{
+    return m_records.capacity() * sizeof(StoredRecord)
+        + m_extents.capacity() * sizeof(Ntfs::ExtentList)
+        + m_names.GetReservedBytes();
+}
+
+// ------------------------------------------------------------------------------------------------
+// Fixed fields and name, name is only added to arena if it changed.
+void RecordStore::SetFields(StoredRecord& stored, const Ntfs::JournalRecord& record)
+{
+    stored.usn = record.m_usn;
+    stored.reason = record.m_reason;
+    stored.fileAttr = record.m_fileAttr;
+    stored.fileId = record.m_fileId;
+    stored.parentId = record.m_parentId;
+    stored.timestamp = record.m_timestamp;
+    stored.length = record.m_length;
+
+    DWORD nameLength = (DWORD)record.m_filename.length();
+    if (stored.pName == NULL || stored.nameLength != nameLength
+        || wmemcmp(stored.pName, record.m_filename.c_str(), nameLength) != 0)
+    {
+        stored.pName = m_names.Add(record.m_filename.c_str(), nameLength);
+        stored.nameLength = nameLength;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+size_t RecordStore::Add(const Ntfs::JournalRecord& record)
+{
+    m_records.resize(m_records.size() + 1);
+    StoredRecord& stored = m_records.back();
+    stored.pName = NULL;
+    stored.extentIdx = sNoExtents;
+    SetFields(stored, record);
+
+    if (!record.m_extents.empty())
+    {
+        stored.extentIdx = (DWORD)m_extents.size();
+        m_extents.push_back(record.m_extents);
+    }
+    return m_records.size() - 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+void RecordStore::Merge(size_t idx, const Ntfs::JournalRecord& record, bool mergeReason)
+{
+    StoredRecord& stored = m_records[idx];
+    DWORD reason = stored.reason | record.m_reason;
+    SetFields(stored, record);
+    if (mergeReason)
+        stored.reason = reason;
+
+    if (!record.m_extents.empty())
+    {
+        if (stored.extentIdx == sNoExtents)
+        {
+            stored.extentIdx = (DWORD)m_extents.size();
+            m_extents.push_back(record.m_extents);
+        }
+        else
+        {
+            Ntfs::ExtentList& extents = m_extents[stored.extentIdx];
+            extents.insert(extents.end(), record.m_extents.begin(), record.m_extents.end());
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void RecordStore::Get(size_t idx, Ntfs::JournalRecord& record) const
+{
+    const StoredRecord& stored = m_records[idx];
+    record.m_usn = stored.usn;
+    record.m_reason = stored.reason;
+    record.m_fileAttr = stored.fileAttr;
+    record.m_fileId = stored.fileId;
+    record.m_parentId = stored.parentId;
+    record.m_timestamp = stored.timestamp;
+    record.m_length = stored.length;
+    record.m_filename.assign(stored.pName, stored.nameLength);
+
+    if (stored.extentIdx == sNoExtents)
+        record.m_extents.clear();
+    else
+        record.m_extents = m_extents[stored.extentIdx];
+}
@@ -0,0 +1,66 @@
+// ------------------------------------------------------------------------------------------------
+// Records kept by a session until they are reported (collected or merged duplicates).
+// Fixed fields live in one array, names and paths in a string arena, so keeping a record
+// costs no allocation of its own and the whole store is released in bulk.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "ntfs.h"
+#include "StringArena.h"
+
+#include <vector>
+
+class RecordStore
+{
+public:
+    RecordStore(void);
+    ~RecordStore(void);
+
+    void Clear();
+
+    // Keep copy of record, return its index.
+    size_t Add(const Ntfs::JournalRecord& record);
+
+    // Newer record of same file replaces stored one, changed byte ranges of both are kept.
+    // Reasons of both are or'ed if mergeReason, else newer reason is kept.
+    void Merge(size_t idx, const Ntfs::JournalRecord& record, bool mergeReason);
+
+    // Copy stored record into record, reusing its string and extent buffers.
+    void Get(size_t idx, Ntfs::JournalRecord& record) const;
+
+    const LARGE_INTEGER& GetTimestamp(size_t idx) const
+    { return m_records[idx].timestamp; }
+
+    size_t GetCount() const
+    { return m_records.size(); }
+    size_t GetMemoryBytes() const;
+    const StringArena& GetNames() const
+    { return m_names; }
+
+private:
+    RecordStore(const RecordStore&);
+    RecordStore& operator=(const RecordStore&);
+
+    static const DWORD sNoExtents = 0xffffffff;
+
+    struct StoredRecord
+    {
+        USN             usn;
+        DWORD           reason;
+        DWORD           fileAttr;
+        FileRef         fileId;
+        FileRef         parentId;
+        LARGE_INTEGER   timestamp;
+        LARGE_INTEGER   length;
+        const wchar_t*  pName;          // in m_names
+        DWORD           nameLength;
+        DWORD           extentIdx;      // into m_extents, sNoExtents if none
+    };
+
+    void SetFields(StoredRecord& stored, const Ntfs::JournalRecord& record);
+
+    std::vector<StoredRecord>       m_records;
+    std::vector<Ntfs::ExtentList>   m_extents;      // only records with V4 byte ranges
+    StringArena                     m_names;
+};
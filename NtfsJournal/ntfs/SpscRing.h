@@ -0,0 +1,176 @@
+// ------------------------------------------------------------------------------------------------
+// Bounded single producer, single consumer ring which connects two pipeline stages.
+// Producer and consumer only share the two indices, so neither takes a lock while the other
+// keeps up. A full ring holds the producer back (backpressure), an empty ring holds the
+// consumer, so the slowest stage sets throughput. A held stage spins briefly, then blocks
+// until the other stage signals progress. Items are swapped in and out, a producer gets back
+// the storage of an item the consumer finished with, so batch buffers are reused instead of
+// reallocated.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Occupancy counters of a ring, read once both stages are done.
+struct RingStats
+{
+    ULONGLONG   pushCount;
+    ULONGLONG   occupancySum;   // items queued at each push, for average
+    size_t      maxOccupancy;
+    ULONGLONG   fullWaits;      // producer found ring full
+    ULONGLONG   emptyWaits;     // consumer found ring empty
+};
+
+template <typename T>
+class SpscRing
+{
+public:
+
+    // Capacity is rounded up to a power of 2.
+    explicit SpscRing(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        m_items.resize(size);
+        m_mask = size - 1;
+        Reset();
+    }
+
+    // Only while neither stage runs.
+    void Reset()
+    {
+        m_head = 0;
+        m_tail = 0;
+        m_closed = false;
+        m_waiters = 0;
+        ZeroMemory(&m_stats, sizeof(m_stats));
+        m_emptyWaits = 0;
+    }
+
+    size_t GetCapacity() const
+    { return m_items.size(); }
+
+    // Producer, swap item into ring, wait while full. Return false if consumer closed ring.
+    bool Push(T& item)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t used = tail - m_head.load(std::memory_order_acquire);
+        if (used == m_items.size())
+        {
+            m_stats.fullWaits++;
+            for (unsigned spin = 0; used == m_items.size(); spin++)
+            {
+                if (m_closed.load(std::memory_order_acquire))
+                    return false;
+                Backoff(spin, [&] { return tail - m_head.load(std::memory_order_acquire) != m_items.size() || IsClosed(); });
+                used = tail - m_head.load(std::memory_order_acquire);
+            }
+        }
+
+        std::swap(m_items[tail & m_mask], item);
+        m_tail.store(tail + 1, std::memory_order_release);
+        Signal();
+
+        m_stats.pushCount++;
+        m_stats.occupancySum += used + 1;
+        m_stats.maxOccupancy = max(m_stats.maxOccupancy, used + 1);
+        return true;
+    }
+
+    // Consumer, swap next item out of ring, wait while empty.
+    // Return false once ring is closed and drained.
+    bool Pop(T& item)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+        {
+            m_emptyWaits++;
+            for (unsigned spin = 0; head == m_tail.load(std::memory_order_acquire); spin++)
+            {
+                // Recheck after seeing closed, producer may have pushed just before closing.
+                if (m_closed.load(std::memory_order_acquire))
+                {
+                    if (head == m_tail.load(std::memory_order_acquire))
+                        return false;
+                    break;
+                }
+                Backoff(spin, [&] { return head != m_tail.load(std::memory_order_acquire) || IsClosed(); });
+            }
+        }
+
+        std::swap(m_items[head & m_mask], item);
+        m_head.store(head + 1, std::memory_order_release);
+        Signal();
+        return true;
+    }
+
+    // Either stage, producer when done or consumer to stop producer.
+    void Close()
+    {
+        m_closed.store(true, std::memory_order_release);
+        Signal();
+    }
+    bool IsClosed() const
+    { return m_closed.load(std::memory_order_acquire); }
+
+    RingStats GetStats() const
+    {
+        RingStats stats = m_stats;
+        stats.emptyWaits = m_emptyWaits;
+        return stats;
+    }
+
+private:
+    SpscRing(const SpscRing&);
+    SpscRing& operator=(const SpscRing&);
+
+    // Spin briefly for a fast peer, then block until a slow one signals that ready() may hold.
+    // Waiter count and ring state are fenced on both sides, so a signal is never missed.
+    template <typename Ready>
+    void Backoff(unsigned spin, Ready ready)
+    {
+        if (spin < 64)
+        {
+            std::this_thread::yield();
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(m_waitLock);
+        m_waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_waitCv.wait(lock, ready);
+        m_waiters.fetch_sub(1);
+    }
+
+    // Wake other stage if it blocks, only takes the lock when it does.
+    void Signal()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_relaxed) != 0)
+        {
+            std::lock_guard<std::mutex> lock(m_waitLock);
+            m_waitCv.notify_all();
+        }
+    }
+
+    std::vector<T>          m_items;
+    size_t                  m_mask;
+    std::atomic<bool>       m_closed;
+    std::atomic<unsigned>   m_waiters;          // stages blocked in Backoff
+    std::mutex              m_waitLock;
+    std::condition_variable m_waitCv;
+
+    // Each index on its own cache line, written by one stage only.
+    alignas(64) std::atomic<size_t> m_head;     // next item to pop, consumer
+    alignas(64) std::atomic<size_t> m_tail;     // next slot to push, producer
+    alignas(64) RingStats   m_stats;            // producer counters
+    alignas(64) ULONGLONG   m_emptyWaits;       // consumer counter
+};
@@ -0,0 +1,66 @@
+// ------------------------------------------------------------------------------------------------
+// Bump allocator for strings kept until a bulk release.
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+
+#include "StringArena.h"
+
+// ------------------------------------------------------------------------------------------------
+StringArena::StringArena(void) :
+    m_used(0),
+    m_stringCount(0),
+    m_usedChars(0),
+    m_reservedChars(0)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+StringArena::~StringArena(void)
+{
+    for (size_t idx = 0; idx < m_chunks.size(); idx++)
+        delete[] m_chunks[idx].pData;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Long strings get a chunk of their own size, the last chunk's free space is given up.
+void StringArena::AddChunk(size_t minChars)
+{
+    Chunk chunk;
+    chunk.size = (minChars > sChunkChars) ? minChars : sChunkChars;
+    chunk.pData = new wchar_t[chunk.size];
+    m_chunks.push_back(chunk);
+    m_used = 0;
+    m_reservedChars += chunk.size;
+}
+
+// ------------------------------------------------------------------------------------------------
+const wchar_t* StringArena::Add(const wchar_t* pStr, size_t length)
+{
+    size_t chars = length + 1;
+    if (m_chunks.empty() || m_used + chars > m_chunks.back().size)
+        AddChunk(chars);
+
+    wchar_t* pCopy = m_chunks.back().pData + m_used;
+    wmemcpy(pCopy, pStr, length);
+    pCopy[length] = 0;
+
+    m_used += chars;
+    m_usedChars += chars;
+    m_stringCount++;
+    return pCopy;
+}
+
+// ------------------------------------------------------------------------------------------------
+void StringArena::Clear()
+{
+    for (size_t idx = 1; idx < m_chunks.size(); idx++)
+        delete[] m_chunks[idx].pData;
+    if (m_chunks.size() > 1)
+        m_chunks.resize(1);
+
+    m_used = 0;
+    m_stringCount = 0;
+    m_usedChars = 0;
+    m_reservedChars = m_chunks.empty() ? 0 : m_chunks[0].size;
+}
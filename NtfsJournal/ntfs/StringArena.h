@@ -0,0 +1,54 @@
+// ------------------------------------------------------------------------------------------------
+// Bump allocator for strings kept until a bulk release.
+// Strings are packed one after the other in large chunks, adding one only moves an offset
+// and Clear frees every string at once, so long scans neither allocate per string nor
+// fragment the heap with many small blocks.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+
+class StringArena
+{
+public:
+    StringArena(void);
+    ~StringArena(void);
+
+    // Copy string (zero terminated in arena), valid until Clear.
+    const wchar_t* Add(const wchar_t* pStr, size_t length);
+
+    // Release all strings, first chunk is kept for reuse.
+    void Clear();
+
+    // Statistics
+    size_t GetStringCount() const
+    { return m_stringCount; }
+    size_t GetChunkCount() const
+    { return m_chunks.size(); }
+    size_t GetUsedBytes() const
+    { return m_usedChars * sizeof(wchar_t); }
+    size_t GetReservedBytes() const
+    { return m_reservedChars * sizeof(wchar_t); }
+
+private:
+    StringArena(const StringArena&);
+    StringArena& operator=(const StringArena&);
+
+    void AddChunk(size_t minChars);
+
+    static const size_t sChunkChars = 64 * 1024;
+
+    struct Chunk
+    {
+        wchar_t*    pData;
+        size_t      size;       // characters
+    };
+
+    std::vector<Chunk>  m_chunks;
+    size_t              m_used;             // characters used of last chunk
+    size_t              m_stringCount;
+    size_t              m_usedChars;        // all chunks
+    size_t              m_reservedChars;
+};
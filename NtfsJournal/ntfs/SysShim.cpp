@@ -0,0 +1,378 @@
+// ------------------------------------------------------------------------------------------------
+// Thin shim over the volume system calls used by Ntfs, with record and replay.
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+#include <Winternl.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "SysShim.h"
+#include "ntfs.h"
+#include "winerrhandlers.h"
+
+// Shim file layout, entries follow the file header.
+//    magic[8], version
+//    { ShimEntryHeader, key bytes, data bytes }...
+static const char sShimMagic[8] = { 'N', 'T', 'J', 'S', 'H', 'I', 'M', 0 };
+static const DWORD sShimVersion = 2;     // 2 = 128 bit file id lookup keys
+
+enum ShimCall { eCallIoctl = 1, eCallLookup = 2 };
+
+struct ShimEntryHeader
+{
+    DWORD   result;         // BOOL of ioctl, status of lookup
+    DWORD   error;          // GetLastError after call
+    DWORD   keyLength;
+    DWORD   dataLength;
+};
+
+struct ShimEntry
+{
+    DWORD       result;
+    DWORD       error;
+    std::string data;
+};
+
+// Entries are keyed by call type and input, so replay does not depend on call order
+// (cache hits or resolve order may differ between runs).
+typedef std::map<std::string, ShimEntry> ShimEntryMap;
+
+static SysShim::Mode sMode = SysShim::eLive;
+static HANDLE sShimHnd = INVALID_HANDLE_VALUE;
+static DWORD sLatencyUsec = 0;
+static ShimEntryMap sEntries;
+static std::mutex sLock;
+
+// ------------------------------------------------------------------------------------------------
+static std::string MakeKey(ShimCall call, const void* pKey1, DWORD key1Len, const void* pKey2, DWORD key2Len)
+{
+    std::string key((const char*)&call, sizeof(call));
+    key.append((const char*)pKey1, key1Len);
+    if (pKey2 != NULL)
+        key.append((const char*)pKey2, key2Len);
+    return key;
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool WriteBytes(const void* pData, DWORD length)
+{
+    DWORD written;
+    return WriteFile(sShimHnd, pData, length, &written, NULL) && written == length;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void RecordEntry(const std::string& key, DWORD result, DWORD error, const void* pData, DWORD dataLength)
+{
+    ShimEntryHeader header;
+    header.result = result;
+    header.error = error;
+    header.keyLength = (DWORD)key.length();
+    header.dataLength = dataLength;
+
+    std::lock_guard<std::mutex> lock(sLock);
+    WriteBytes(&header, sizeof(header));
+    WriteBytes(key.data(), header.keyLength);
+    if (dataLength != 0)
+        WriteBytes(pData, dataLength);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return replayed entry or NULL, after injected latency.
+static const ShimEntry* ReplayEntry(const std::string& key)
+{
+    if (sLatencyUsec != 0)
+    {
+        // Spin, Sleep granularity is far coarser than a typical ioctl.
+        LARGE_INTEGER freq, start, now;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&start);
+        LONGLONG ticks = freq.QuadPart * sLatencyUsec / 1000000;
+        do {
+            YieldProcessor();
+            QueryPerformanceCounter(&now);
+        } while (now.QuadPart - start.QuadPart < ticks);
+    }
+
+    ShimEntryMap::const_iterator iter = sEntries.find(key);
+    return (iter != sEntries.end()) ? &iter->second : NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool SysShim::Record(const wchar_t* shimPath, std::wstring& errorMsg)
+{
+    Close();
+    sShimHnd = CreateFile(shimPath, GENERIC_WRITE,
+        FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (sShimHnd == INVALID_HANDLE_VALUE
+        || !WriteBytes(sShimMagic, sizeof(sShimMagic))
+        || !WriteBytes(&sShimVersion, sizeof(sShimVersion)))
+    {
+        errorMsg = WinErrHandlers::ErrorMsg(GetLastError());
+        Close();
+        return false;
+    }
+
+    sMode = eRecord;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool SysShim::Replay(const wchar_t* shimPath, std::wstring& errorMsg)
+{
+    Close();
+    HANDLE fileHnd = CreateFile(shimPath, GENERIC_READ,
+        FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER fileSize;
+    if (fileHnd == INVALID_HANDLE_VALUE || !GetFileSizeEx(fileHnd, &fileSize))
+    {
+        errorMsg = WinErrHandlers::ErrorMsg(GetLastError());
+        if (fileHnd != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHnd);
+        return false;
+    }
+
+    std::vector<BYTE> content((size_t)fileSize.QuadPart + 1);
+    DWORD bytesRead = 0;
+    BOOL ok = ReadFile(fileHnd, &content[0], (DWORD)fileSize.QuadPart, &bytesRead, NULL);
+    CloseHandle(fileHnd);
+
+    const size_t fileHeaderSize = sizeof(sShimMagic) + sizeof(sShimVersion);
+    if (!ok || bytesRead != fileSize.QuadPart || bytesRead < fileHeaderSize
+        || memcmp(&content[0], sShimMagic, sizeof(sShimMagic)) != 0
+        || *(const DWORD*)&content[sizeof(sShimMagic)] != sShimVersion)
+    {
+        errorMsg = L"Not a system call recording";
+        return false;
+    }
+
+    size_t pos = fileHeaderSize;
+    while (pos + sizeof(ShimEntryHeader) <= bytesRead)
+    {
+        const ShimEntryHeader* pHeader = (const ShimEntryHeader*)&content[pos];
+        pos += sizeof(ShimEntryHeader);
+        if (pos + pHeader->keyLength + pHeader->dataLength > bytesRead)
+            break;
+
+        std::string key((const char*)&content[pos], pHeader->keyLength);
+        pos += pHeader->keyLength;
+
+        ShimEntry& entry = sEntries[key];
+        entry.result = pHeader->result;
+        entry.error = pHeader->error;
+        entry.data.assign((const char*)&content[pos], pHeader->dataLength);
+        pos += pHeader->dataLength;
+    }
+
+    sMode = eReplay;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void SysShim::SetLatency(DWORD latencyUsec)
+{
+    sLatencyUsec = latencyUsec;
+}
+
+// ------------------------------------------------------------------------------------------------
+void SysShim::Close()
+{
+    if (sShimHnd != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(sShimHnd);
+        sShimHnd = INVALID_HANDLE_VALUE;
+    }
+    sEntries.clear();
+    sMode = eLive;
+}
+
+// ------------------------------------------------------------------------------------------------
+SysShim::Mode SysShim::GetMode()
+{
+    return sMode;
+}
+
+// ------------------------------------------------------------------------------------------------
+HANDLE SysShim::OpenVolume(const wchar_t* volumePath)
+{
+    // Replay needs no volume, any closeable handle will do.
+    if (sMode == eReplay)
+        return CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    return CreateFile(volumePath, GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+}
+
+// ------------------------------------------------------------------------------------------------
+BOOL SysShim::DeviceIoControl(HANDLE volHnd, DWORD ioctlCode,
+        LPVOID pInBuffer, DWORD inLength,
+        LPVOID pOutBuffer, DWORD outLength, LPDWORD pBytesReturned)
+{
+    if (sMode == eLive)
+        return ::DeviceIoControl(volHnd, ioctlCode, pInBuffer, inLength,
+            pOutBuffer, outLength, pBytesReturned, NULL);
+
+    std::string key = MakeKey(eCallIoctl, &ioctlCode, sizeof(ioctlCode), pInBuffer, inLength);
+    if (sMode == eRecord)
+    {
+        BOOL result = ::DeviceIoControl(volHnd, ioctlCode, pInBuffer, inLength,
+            pOutBuffer, outLength, pBytesReturned, NULL);
+        DWORD error = GetLastError();
+        RecordEntry(key, result, error, pOutBuffer, result ? *pBytesReturned : 0);
+        SetLastError(error);
+        return result;
+    }
+
+    const ShimEntry* pEntry = ReplayEntry(key);
+    if (pEntry == NULL)
+    {
+        *pBytesReturned = 0;
+        SetLastError(ERROR_NOT_FOUND);
+        return FALSE;
+    }
+
+    // Cut output would end mid record while its first USN still resumes after the whole
+    // recorded batch, caller has to ask again with a buffer as large as the recording's.
+    DWORD length = (DWORD)pEntry->data.length();
+    if (length > outLength)
+    {
+        *pBytesReturned = 0;
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return FALSE;
+    }
+    if (length != 0)
+        memcpy(pOutBuffer, pEntry->data.data(), length);
+    *pBytesReturned = length;
+    SetLastError(pEntry->error);
+    return (BOOL)pEntry->result;
+}
+
+// ------------------------------------------------------------------------------------------------
+static DWORD LiveLookupFileId(HANDLE volHnd, const FileRef& fileId, bool getLength,
+        std::wstring& fullPath, LARGE_INTEGER& allocatedSize)
+{
+    typedef ULONG (__stdcall *pNtCreateFile)
+    (
+        PHANDLE FileHandle,
+        ULONG DesiredAccess,
+        PVOID ObjectAttributes,
+        PVOID IoStatusBlock,
+        PLARGE_INTEGER AllocationSize,
+        ULONG FileAttributes,
+        ULONG ShareAccess,
+        ULONG CreateDisposition,
+        ULONG CreateOptions,
+        PVOID EaBuffer,
+        ULONG EaLength
+    );
+
+    static pNtCreateFile NtCreatefile = (pNtCreateFile)GetProcAddress(GetModuleHandle(L"ntdll.dll"), "NtCreateFile");
+
+    /*
+        UNICODE_STRING
+            USHORT Length;
+            USHORT MaximumLength;
+            PWSTR  Buffer;
+    */
+    // Name is the 8 byte NTFS id, or 16 byte FILE_ID_128 (ReFS).
+    ULONGLONG fileIdBuf[2] = { fileId.low, fileId.high };
+    USHORT szFileId = (USHORT)(fileId.Is64() ? sizeof(ULONGLONG) : sizeof(fileIdBuf));
+    UNICODE_STRING fidstr = {szFileId, szFileId, (PWSTR) fileIdBuf};
+
+    /*  OBJECT_ATTRIBUTES
+            ULONG Length;                   // sizeof(OBJECT_ATTRIBUTES)
+            HANDLE RootDirectory;           // volume handle
+            PUNICODE_STRING ObjectName;     // &fidstr
+            ULONG Attributes;               // OBJ_CASE_INSENSITIVE
+            PVOID SecurityDescriptor;       // NULL
+            PVOID SecurityQualityOfService; // NULL
+    */
+    OBJECT_ATTRIBUTES objAttr = { sizeof(OBJECT_ATTRIBUTES), volHnd, &fidstr, OBJ_CASE_INSENSITIVE, NULL, NULL };
+
+    IO_STATUS_BLOCK iosb;
+    ZeroMemory(&iosb, sizeof(iosb));
+    HANDLE fHnd;
+
+    ULONG status = NtCreatefile(
+            &fHnd,                      // FileHandle,
+            FILE_READ_ATTRIBUTES,       // DesiredAccess,
+            &objAttr,                   // ObjectAttributes,
+            &iosb,                      // IoStatusBlock,
+            NULL,                       // Allocated Size,
+            FILE_ATTRIBUTE_NORMAL,      // FileAttributes
+            FILE_SHARE_READ | FILE_SHARE_WRITE,  // ShareAccess,
+            FILE_OPEN,                  // CreateDisposition,
+            FILE_OPEN_BY_FILE_ID,       // CreateOptions
+            NULL,                       // EaBuffer,
+            0);                         // EaLength
+
+    if (NT_ERROR(status))
+    {
+        // STATUS_INVALID_PARAMETER    0xC000000DL
+        return status;
+    }
+
+    struct FileName
+    {
+        DWORD   length;
+        wchar_t name[MAX_PATH];
+    } fileName;
+
+    DWORD error = 0;
+    if (0 == GetFileInformationByHandleEx(fHnd, FileNameInfo, &fileName, sizeof(fileName)))
+    {
+        error = GetLastError();
+    }
+    else
+    {
+        fileName.name[fileName.length/sizeof(wchar_t)] = 0;
+        fullPath = fileName.name;
+
+        if (getLength)
+        {
+            FILE_STANDARD_INFO standardInfo;
+            if (0 != GetFileInformationByHandleEx(
+                    fHnd, FileStandardInfo, &standardInfo, sizeof(standardInfo)))
+            {
+                allocatedSize = standardInfo.AllocationSize;
+            }
+        }
+    }
+
+    CloseHandle(fHnd);
+    return error;
+}
+
+// ------------------------------------------------------------------------------------------------
+DWORD SysShim::LookupFileId(HANDLE volHnd, const FileRef& fileId, bool getLength,
+        std::wstring& fullPath, LARGE_INTEGER& allocatedSize)
+{
+    allocatedSize.QuadPart = 0;
+    if (sMode == eLive)
+        return LiveLookupFileId(volHnd, fileId, getLength, fullPath, allocatedSize);
+
+    BYTE withLength = getLength ? 1 : 0;
+    std::string key = MakeKey(eCallLookup, &fileId, sizeof(fileId), &withLength, sizeof(withLength));
+    if (sMode == eRecord)
+    {
+        DWORD status = LiveLookupFileId(volHnd, fileId, getLength, fullPath, allocatedSize);
+        std::string data((const char*)&allocatedSize, sizeof(allocatedSize));
+        if (status == 0)
+            data.append((const char*)fullPath.data(), (DWORD)(fullPath.length() * sizeof(wchar_t)));
+        RecordEntry(key, status, 0, data.data(), (DWORD)data.length());
+        return status;
+    }
+
+    const ShimEntry* pEntry = ReplayEntry(key);
+    if (pEntry == NULL)
+        return ERROR_NOT_FOUND;
+
+    if (pEntry->result == 0 && pEntry->data.length() >= sizeof(allocatedSize))
+    {
+        memcpy(&allocatedSize, pEntry->data.data(), sizeof(allocatedSize));
+        fullPath.assign((const wchar_t*)(pEntry->data.data() + sizeof(allocatedSize)),
+            (pEntry->data.length() - sizeof(allocatedSize)) / sizeof(wchar_t));
+    }
+    return pEntry->result;
+}
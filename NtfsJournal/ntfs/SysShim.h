@@ -0,0 +1,41 @@
+// ------------------------------------------------------------------------------------------------
+// Thin shim over the volume system calls used by Ntfs (volume open, journal ioctls and
+// open-by-file-id lookups). Record mode saves every result to a file, replay mode serves
+// them back without a volume, with optional injected latency per call.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+
+#include "FileRef.h"
+
+namespace SysShim {
+    enum Mode { eLive, eRecord, eReplay };
+
+    // Start record or replay session, return false and set errorMsg on failure.
+    bool Record(const wchar_t* shimPath, std::wstring& errorMsg);
+    bool Replay(const wchar_t* shimPath, std::wstring& errorMsg);
+
+    // Delay added to every replayed call, microseconds.
+    void SetLatency(DWORD latencyUsec);
+
+    // Flush and end record or replay session.
+    void Close();
+
+    Mode GetMode();
+
+    // CreateFile of volume, replay returns a placeholder handle.
+    HANDLE OpenVolume(const wchar_t* volumePath);
+
+    // Synchronous DeviceIoControl on volume.
+    BOOL DeviceIoControl(HANDLE volHnd, DWORD ioctlCode,
+            LPVOID pInBuffer, DWORD inLength,
+            LPVOID pOutBuffer, DWORD outLength, LPDWORD pBytesReturned);
+
+    // Open file by id (NtCreateFile FILE_OPEN_BY_FILE_ID) and get its volume relative path
+    // and optionally its allocated size. Return 0 on success, else NTSTATUS or Win32 error.
+    DWORD LookupFileId(HANDLE volHnd, const FileRef& fileId, bool getLength,
+            std::wstring& fullPath, LARGE_INTEGER& allocatedSize);
+}
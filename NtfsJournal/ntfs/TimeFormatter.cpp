@@ -0,0 +1,287 @@
+// ------------------------------------------------------------------------------------------------
+// Journal timestamp formatted as local "date time", with per day cache.
+// ------------------------------------------------------------------------------------------------
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+#include <string.h>
+#include <wchar.h>
+
+#include "TimeFormatter.h"
+
+static const long long sTicksPerSecond = 10000000;
+static const long long sTicksPerDay = sTicksPerSecond * 24 * 60 * 60;
+static const long long sTicksPerQuarter = sTicksPerSecond * 15 * 60;
+static const long long sDays1601To1970 = 134774;
+
+static const wchar_t* sDayNames[] =
+{ L"Sunday", L"Monday", L"Tuesday", L"Wednesday", L"Thursday", L"Friday", L"Saturday" };
+static const wchar_t* sMonthNames[] =
+{ L"January", L"February", L"March", L"April", L"May", L"June",
+  L"July", L"August", L"September", L"October", L"November", L"December" };
+
+// ------------------------------------------------------------------------------------------------
+static long long FloorDiv(long long value, long long divisor)
+{
+    long long quotient = value / divisor;
+    return (value % divisor < 0) ? quotient - 1 : quotient;
+}
+
+// ------------------------------------------------------------------------------------------------
+TimeFormatter::TimeFormatter(void) :
+    m_startUtc(0),
+    m_endUtc(0),
+    m_offset(0),
+    m_dayLocal(0),
+    m_dateLength(0),
+    m_dayChanges(0),
+    m_length(0)
+{
+    m_text[0] = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+void TimeFormatter::AddLiteral(FieldList& fields, const wchar_t* pStr, size_t length)
+{
+    if (!fields.empty() && fields.back().type == eLiteral)
+    {
+        fields.back().length += (unsigned short)length;
+    }
+    else
+    {
+        Field field = { eLiteral, 0, (unsigned short)m_literals.length(), (unsigned short)length };
+        fields.push_back(field);
+    }
+    m_literals.append(pStr, length);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Same picture letters as GetDateFormat (d M y g) and GetTimeFormat (h H m s t),
+// text in single quotes is copied, '' inside quotes is one quote. Era (g) is ignored.
+
+void TimeFormatter::CompilePicture(const wchar_t* pFmt, bool isDate, FieldList& fields)
+{
+    fields.clear();
+    while (*pFmt != 0)
+    {
+        wchar_t chr = *pFmt;
+        if (chr == '\'')
+        {
+            for (pFmt++; *pFmt != 0; pFmt++)
+            {
+                if (*pFmt == '\'')
+                {
+                    if (pFmt[1] != '\'')
+                        break;
+                    pFmt++;
+                }
+                AddLiteral(fields, pFmt, 1);
+            }
+            if (*pFmt != 0)
+                pFmt++;
+            continue;
+        }
+
+        unsigned count = 0;
+        while (pFmt[count] == chr)
+            count++;
+
+        Field field = { eLiteral, (unsigned char)(count < 255 ? count : 255), 0, 0 };
+        switch (isDate ? chr : 0)
+        {
+        case 'd':   field.type = (count <= 2) ? eDay : eDayName;        break;
+        case 'M':   field.type = (count <= 2) ? eMonth : eMonthName;    break;
+        case 'y':   field.type = eYear;     break;
+        case 'g':   pFmt += count;          continue;
+        }
+        switch (isDate ? 0 : chr)
+        {
+        case 'h':   field.type = eHour12;   break;
+        case 'H':   field.type = eHour24;   break;
+        case 'm':   field.type = eMinute;   break;
+        case 's':   field.type = eSecond;   break;
+        case 't':   field.type = eMarker;   break;
+        }
+
+        if (field.type == eLiteral)
+            AddLiteral(fields, pFmt, count);
+        else
+            fields.push_back(field);
+        pFmt += count;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void TimeFormatter::Compile(const wchar_t* dateFmt, const wchar_t* timeFmt)
+{
+    m_literals.clear();
+    CompilePicture(dateFmt, true, m_dateFields);
+    CompilePicture(timeFmt, false, m_timeFields);
+    m_startUtc = m_endUtc = 0;
+    m_length = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Local time minus UTC at time, DST rules of current time zone as SystemTimeToTzSpecificLocalTime.
+
+long long TimeFormatter::GetLocalOffset(long long utcTicks)
+{
+#ifdef _WIN32
+    ULARGE_INTEGER ticks;
+    ticks.QuadPart = (ULONGLONG)utcTicks;
+    FILETIME utcTime = { ticks.LowPart, ticks.HighPart };
+    SYSTEMTIME systemTime;
+    SYSTEMTIME localTime;
+    FILETIME localFileTime;
+    if (!FileTimeToSystemTime(&utcTime, &systemTime)
+        || !SystemTimeToTzSpecificLocalTime(NULL, &systemTime, &localTime)
+        || !SystemTimeToFileTime(&localTime, &localFileTime))
+        return 0;
+
+    ticks.LowPart = localFileTime.dwLowDateTime;
+    ticks.HighPart = localFileTime.dwHighDateTime;
+    // System time drops sub millisecond ticks, offsets are whole minutes.
+    long long offset = (long long)ticks.QuadPart - utcTicks;
+    const long long ticksPerMinute = sTicksPerSecond * 60;
+    return FloorDiv(offset + ticksPerMinute / 2, ticksPerMinute) * ticksPerMinute;
+#else
+    time_t unixTime = (time_t)FloorDiv(utcTicks - sDays1601To1970 * sTicksPerDay, sTicksPerSecond);
+    struct tm localTm;
+    if (localtime_r(&unixTime, &localTm) == NULL)
+        return 0;
+    return (long long)localTm.tm_gmtoff * sTicksPerSecond;
+#endif
+}
+
+// ------------------------------------------------------------------------------------------------
+void TimeFormatter::Append(const wchar_t* pStr, size_t length)
+{
+    if (length > sMaxChars - 1 - m_length)
+        length = sMaxChars - 1 - m_length;
+    wmemcpy(m_text + m_length, pStr, length);
+    m_length += length;
+}
+
+// ------------------------------------------------------------------------------------------------
+void TimeFormatter::AppendNumber(unsigned value, unsigned minDigits)
+{
+    wchar_t digits[12];
+    wchar_t* pDigit = digits + 12;
+    do
+    {
+        *--pDigit = (wchar_t)(L'0' + value % 10);
+        value /= 10;
+    } while (value != 0 || digits + 12 - pDigit < (int)minDigits);
+    Append(pDigit, digits + 12 - pDigit);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Compute offset and formatted date of local day containing time. A day with a daylight
+// saving change only caches a quarter hour, offsets change on quarter hour boundaries.
+
+void TimeFormatter::SetDay(long long utcTicks)
+{
+    m_dayChanges++;
+    m_offset = GetLocalOffset(utcTicks);
+    long long localTicks = utcTicks + m_offset;
+    m_dayLocal = FloorDiv(localTicks, sTicksPerDay) * sTicksPerDay;
+    m_startUtc = m_dayLocal - m_offset;
+    m_endUtc = m_startUtc + sTicksPerDay;
+    if (GetLocalOffset(m_startUtc) != m_offset || GetLocalOffset(m_endUtc - 1) != m_offset)
+    {
+        m_startUtc = FloorDiv(localTicks, sTicksPerQuarter) * sTicksPerQuarter - m_offset;
+        m_endUtc = m_startUtc + sTicksPerQuarter;
+    }
+
+    // Civil date from days since 1970 (proleptic Gregorian, as FileTimeToSystemTime).
+    long long days = m_dayLocal / sTicksPerDay - sDays1601To1970;
+    unsigned weekDay = (unsigned)((days % 7 + 11) % 7);      // 1970-01-01 was Thursday
+    long long z = days + 719468;
+    long long era = FloorDiv(z, 146097);
+    unsigned dayOfEra = (unsigned)(z - era * 146097);
+    unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned monthIdx = (5 * dayOfYear + 2) / 153;
+    unsigned day = dayOfYear - (153 * monthIdx + 2) / 5 + 1;
+    unsigned month = (monthIdx < 10) ? monthIdx + 3 : monthIdx - 9;
+    unsigned year = (unsigned)(yearOfEra + era * 400 + (month <= 2 ? 1 : 0));
+
+    m_length = 0;
+    for (size_t idx = 0; idx < m_dateFields.size(); idx++)
+    {
+        const Field& field = m_dateFields[idx];
+        switch (field.type)
+        {
+        case eLiteral:
+            Append(m_literals.c_str() + field.offset, field.length);
+            break;
+        case eDay:
+            AppendNumber(day, field.count);
+            break;
+        case eDayName:
+            Append(sDayNames[weekDay], (field.count == 3) ? 3 : wcslen(sDayNames[weekDay]));
+            break;
+        case eMonth:
+            AppendNumber(month, field.count);
+            break;
+        case eMonthName:
+            Append(sMonthNames[month - 1], (field.count == 3) ? 3 : wcslen(sMonthNames[month - 1]));
+            break;
+        case eYear:
+            if (field.count <= 2)
+                AppendNumber(year % 100, field.count);
+            else
+                AppendNumber(year, 4);
+            break;
+        }
+    }
+    Append(L" ", 1);
+    m_dateLength = m_length;
+}
+
+// ------------------------------------------------------------------------------------------------
+const wchar_t* TimeFormatter::Format(long long utcTicks, size_t& length)
+{
+    if (utcTicks < m_startUtc || utcTicks >= m_endUtc)
+        SetDay(utcTicks);
+
+    unsigned seconds = (unsigned)((utcTicks + m_offset - m_dayLocal) / sTicksPerSecond);
+    unsigned hour = seconds / 3600;
+    unsigned minute = seconds / 60 % 60;
+    unsigned second = seconds % 60;
+
+    m_length = m_dateLength;
+    for (size_t idx = 0; idx < m_timeFields.size(); idx++)
+    {
+        const Field& field = m_timeFields[idx];
+        unsigned minDigits = (field.count >= 2) ? 2 : 1;
+        switch (field.type)
+        {
+        case eLiteral:
+            Append(m_literals.c_str() + field.offset, field.length);
+            break;
+        case eHour12:
+            AppendNumber((hour % 12 == 0) ? 12 : hour % 12, minDigits);
+            break;
+        case eHour24:
+            AppendNumber(hour, minDigits);
+            break;
+        case eMinute:
+            AppendNumber(minute, minDigits);
+            break;
+        case eSecond:
+            AppendNumber(second, minDigits);
+            break;
+        case eMarker:
+            Append((hour < 12) ? L"AM" : L"PM", minDigits);
+            break;
+        }
+    }
+
+    m_text[m_length] = 0;
+    length = m_length;
+    return m_text;
+}
@@ -0,0 +1,74 @@
+// ------------------------------------------------------------------------------------------------
+// Journal timestamp (FILETIME ticks, UTC) formatted as local "date time".
+// Date and time pictures (dateFmt, timeFmt, same letters as GetDateFormat and GetTimeFormat)
+// are compiled once. Calendar fields are computed arithmetically, the formatted date and
+// local time offset are cached for the current day, so most records only format the time.
+// No Win32 calls besides the local time offset, so it also builds for offline use on Linux.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+class TimeFormatter
+{
+public:
+    TimeFormatter(void);
+
+    // Date picture:  d dd ddd dddd  M MM MMM MMMM  y yy yyyy  'quoted text'
+    // Time picture:  h hh H HH  m mm  s ss  t tt  'quoted text'
+    // Day and month names and time markers are English.
+    void Compile(const wchar_t* dateFmt, const wchar_t* timeFmt);
+
+    // Return formatted local date and time, valid until next call.
+    const wchar_t* Format(long long utcTicks, size_t& length);
+
+    const wchar_t* Format(long long utcTicks)
+    { size_t length; return Format(utcTicks, length); }
+
+    // Number of times date and offset were recomputed, rest of records used the cache.
+    unsigned GetDayChanges() const
+    { return m_dayChanges; }
+
+private:
+    enum FieldType
+    {
+        eLiteral,
+        eDay, eDayName, eMonth, eMonthName, eYear,
+        eHour12, eHour24, eMinute, eSecond, eMarker
+    };
+
+    struct Field
+    {
+        unsigned char   type;
+        unsigned char   count;      // picture letters, 2 = leading zero
+        unsigned short  offset;     // literal in m_literals
+        unsigned short  length;
+    };
+    typedef std::vector<Field> FieldList;
+
+    void CompilePicture(const wchar_t* pFmt, bool isDate, FieldList& fields);
+    void AddLiteral(FieldList& fields, const wchar_t* pStr, size_t length);
+    void SetDay(long long utcTicks);
+    void Append(const wchar_t* pStr, size_t length);
+    void AppendNumber(unsigned value, unsigned minDigits);
+
+    static long long GetLocalOffset(long long utcTicks);
+
+    FieldList       m_dateFields;
+    FieldList       m_timeFields;
+    std::wstring    m_literals;
+
+    // Cached day, [m_startUtc, m_endUtc) share date and offset.
+    long long       m_startUtc;
+    long long       m_endUtc;
+    long long       m_offset;           // local - utc ticks
+    long long       m_dayLocal;         // local ticks of midnight
+    size_t          m_dateLength;       // date and separating space at start of m_text
+    unsigned        m_dayChanges;
+
+    static const size_t sMaxChars = 128;
+    wchar_t         m_text[sMaxChars];
+    size_t          m_length;
+};
@@ -0,0 +1,334 @@
+// ------------------------------------------------------------------------------------------------
+// Offline NTFS Journal reader.
+// Memory map an extracted $Extend\$UsnJrnl:$J stream and walk its USN records in place.
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#endif
+
+#include "UsnFile.h"
+#include "winerrhandlers.h"
+
+// Map large views to keep remap count low, 32bit builds have limited address space.
+#ifdef _WIN64
+static const ULONGLONG sViewSize = 1024 * 1024 * 1024;
+#else
+static const ULONGLONG sViewSize = 64 * 1024 * 1024;
+#endif
+
+// Pages after a bisected end of zero prefix which must hold valid record chains.
+static const unsigned sConfirmPages = 4;
+
+// ------------------------------------------------------------------------------------------------
+UsnFile::UsnFile(void) :
+    m_mapHnd(NULL),
+    m_view(NULL),
+    m_viewOffset(0),
+    m_viewSize(0),
+    m_size(0),
+    m_pos(0)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+UsnFile::~UsnFile(void)
+{
+    Close();
+}
+
+// ------------------------------------------------------------------------------------------------
+bool UsnFile::Open(const wchar_t* filePath)
+{
+    Close();
+    m_path = filePath;
+
+    m_fileHnd = CreateFile(filePath, GENERIC_READ,
+        FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (!m_fileHnd.IsValid())
+    {
+        SaveLastError();
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_fileHnd, &fileSize))
+    {
+        SaveLastError();
+        Close();
+        return false;
+    }
+    m_size = fileSize.QuadPart;
+
+    if (m_size == 0)
+    {
+        SaveLastError(ERROR_HANDLE_EOF);
+        Close();
+        return false;
+    }
+
+    m_mapHnd = CreateFileMapping(m_fileHnd, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_mapHnd == NULL)
+    {
+        SaveLastError();
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void UsnFile::Close()
+{
+    if (m_view != NULL)
+    {
+        UnmapViewOfFile(m_view);
+        m_view = NULL;
+    }
+    m_viewOffset = m_viewSize = 0;
+
+    if (m_mapHnd != NULL)
+    {
+        CloseHandle(m_mapHnd);
+        m_mapHnd = NULL;
+    }
+
+    m_fileHnd = INVALID_HANDLE_VALUE;
+    m_size = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Map view which includes 'offset', view starts on allocation granularity.
+bool UsnFile::MapView(ULONGLONG offset)
+{
+    static DWORD sGranularity = 0;
+    if (sGranularity == 0)
+    {
+        SYSTEM_INFO sysInfo;
+        GetSystemInfo(&sysInfo);
+        sGranularity = sysInfo.dwAllocationGranularity;
+    }
+
+    if (m_view != NULL)
+        UnmapViewOfFile(m_view);
+
+    m_viewOffset = offset - (offset % sGranularity);
+    m_viewSize = m_size - m_viewOffset;
+    if (m_viewSize > sViewSize)
+        m_viewSize = sViewSize;
+
+    m_view = (const BYTE*)MapViewOfFile(m_mapHnd, FILE_MAP_READ,
+        (DWORD)(m_viewOffset >> 32), (DWORD)m_viewOffset, (SIZE_T)m_viewSize);
+
+    if (m_view == NULL)
+    {
+        SaveLastError();
+        m_viewOffset = m_viewSize = 0;
+        return false;
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return true if block is all zero. Block is 16 byte aligned and a multiple of 64 bytes long.
+static bool IsZeroBlock(const BYTE* pBlock, size_t length)
+{
+#if defined(_M_X64) || defined(_M_IX86)
+    const __m128i* pVec = (const __m128i*)pBlock;
+    const __m128i* pEnd = (const __m128i*)(pBlock + length);
+    __m128i acc = _mm_setzero_si128();
+    for (; pVec < pEnd; pVec += 4)
+    {
+        acc = _mm_or_si128(acc, _mm_or_si128(
+            _mm_or_si128(_mm_load_si128(pVec + 0), _mm_load_si128(pVec + 1)),
+            _mm_or_si128(_mm_load_si128(pVec + 2), _mm_load_si128(pVec + 3))));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) == 0xffff;
+#else
+    const ULONGLONG* pWord = (const ULONGLONG*)pBlock;
+    const ULONGLONG* pEnd = (const ULONGLONG*)(pBlock + length);
+    ULONGLONG acc = 0;
+    for (; pWord < pEnd; pWord += 4)
+        acc |= pWord[0] | pWord[1] | pWord[2] | pWord[3];
+    return acc == 0;
+#endif
+}
+
+// ------------------------------------------------------------------------------------------------
+// Ask file system for first allocated byte at or after offset, works if extracted file kept
+// its sparse layout. Return false if not available.
+bool UsnFile::QueryFirstAllocated(ULONGLONG offset, ULONGLONG& allocOffset) const
+{
+    if (offset >= m_size)
+        return false;
+
+    FILE_ALLOCATED_RANGE_BUFFER queryRange;
+    queryRange.FileOffset.QuadPart = offset;
+    queryRange.Length.QuadPart = m_size - offset;
+
+    FILE_ALLOCATED_RANGE_BUFFER allocRange;
+    DWORD cb = 0;
+    BOOL ok = DeviceIoControl(m_fileHnd, FSCTL_QUERY_ALLOCATED_RANGES,
+        &queryRange, sizeof(queryRange), &allocRange, sizeof(allocRange), &cb, NULL);
+
+    // ERROR_MORE_DATA is okay, we only want the first range.
+    if ((!ok && GetLastError() != ERROR_MORE_DATA) || cb < sizeof(allocRange))
+        return false;
+
+    allocOffset = allocRange.FileOffset.QuadPart;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool UsnFile::IsZeroPage(ULONGLONG offset)
+{
+    if (m_view == NULL || offset < m_viewOffset || offset + sPageSize > m_viewOffset + m_viewSize)
+    {
+        if (!MapView(offset))
+            return false;
+    }
+
+    return IsZeroBlock(m_view + (offset - m_viewOffset), sPageSize);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return true if pageCount pages from page (or up to last page) each hold a chain of valid
+// records followed by zero fill, as live journal pages do.
+bool UsnFile::IsRecordRun(ULONGLONG page, ULONGLONG lastPage, unsigned pageCount)
+{
+    for (; pageCount != 0 && page <= lastPage; pageCount--, page += sPageSize)
+    {
+        // Also maps view which holds page.
+        if (IsZeroPage(page) || m_view == NULL
+            || page < m_viewOffset || page + sPageSize > m_viewOffset + m_viewSize)
+            return false;
+
+        const BYTE* pPage = m_view + (page - m_viewOffset);
+        DWORD pos = 0;
+        while (pos + sizeof(USN_RECORD_COMMON_HEADER) <= sPageSize
+            && ((const USN_RECORD_COMMON_HEADER*)(pPage + pos))->RecordLength != 0)
+        {
+            const USN_RECORD_COMMON_HEADER* pRecord = (const USN_RECORD_COMMON_HEADER*)(pPage + pos);
+            if (!IsValidRecord(pRecord, page + pos, sPageSize - pos))
+                return false;
+            pos += pRecord->RecordLength;
+        }
+        if (pos == 0)
+            return false;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return offset of first journal page at or after usn which is not zero filled.
+//
+// An extracted $J is mostly a zero filled prefix (journal space already released) followed
+// by live records. Rather than walking the prefix, locate its end with:
+//   1. File system allocated ranges, if the extracted copy is still sparse.
+//   2. Binary search on page boundaries for end of zero prefix, confirmed by walking the
+//      record chain of the pages after it.
+//   3. Vectorized zero page scan, if the bisected page is not confirmed.
+ULONGLONG UsnFile::FindFirstRecord(ULONGLONG usn)
+{
+    if (m_size < sPageSize || usn >= m_size)
+        return usn;
+
+    // Only whole pages are probed, last partial page is left to the record walk.
+    const ULONGLONG pageMask = ~(ULONGLONG)(sPageSize - 1);
+    ULONGLONG page = usn & pageMask;
+    ULONGLONG lastPage = (m_size & pageMask) - sPageSize;
+
+    ULONGLONG allocOffset;
+    if (QueryFirstAllocated(page, allocOffset) && allocOffset > page)
+        page = (allocOffset <= lastPage) ? (allocOffset & pageMask) : lastPage;
+
+    ULONGLONG bisectPage = 0;       // 0 = no result
+    if (page < lastPage && IsZeroPage(page) && !IsZeroPage(lastPage))
+    {
+        // Invariant: lo is zero page, hi is not.
+        ULONGLONG lo = page;
+        ULONGLONG hi = lastPage;
+        while (hi - lo > sPageSize)
+        {
+            ULONGLONG mid = lo + (((hi - lo) / 2) & pageMask);
+            if (IsZeroPage(mid))
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        if (IsZeroPage(hi - sPageSize) && IsRecordRun(hi, lastPage, sConfirmPages))
+            bisectPage = hi;
+    }
+
+    if (bisectPage != 0)
+    {
+        page = bisectPage;
+    }
+    else
+    {
+        ULONGLONG scanStart = page;
+        while (page <= lastPage && IsZeroPage(page))
+            page += sPageSize;
+
+        if (page > scanStart + sPageSize && page <= lastPage)
+        {
+            wchar_t msg[120];
+            swprintf_s(msg, ARRAYSIZE(msg), L"Zero prefix not confirmed by record chain, scanned %llu pages",
+                (page - scanStart) / sPageSize);
+            m_noteMsg = msg;
+        }
+    }
+
+    return (page > usn) ? page : usn;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool UsnFile::Start(USN startUsn, DWORD)
+{
+    if (!IsOpen())
+        return false;
+
+    // Records are 8 byte aligned.
+    ULONGLONG usn = (startUsn > 0) ? ((ULONGLONG)startUsn & ~(ULONGLONG)7) : 0;
+    m_pos = FindFirstRecord(usn);
+    m_skippedBytes = m_pos - usn;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Hand out next run of pages in place, batch ends on page boundary so no record is split.
+bool UsnFile::ReadBatch(JournalBatch& batch)
+{
+    if (m_pos + sizeof(USN_RECORD) > m_size)
+        return false;
+
+    // Keep at least one journal page ahead inside the view so a record never straddles it.
+    ULONGLONG viewEnd = m_viewOffset + m_viewSize;
+    if (m_view == NULL || m_pos < m_viewOffset || (m_pos + sPageSize > viewEnd && viewEnd < m_size))
+    {
+        if (!MapView(m_pos))
+            return ReadFailed();
+        viewEnd = m_viewOffset + m_viewSize;
+    }
+
+    ULONGLONG end = m_pos + sBatchSize;
+    if (end >= viewEnd)
+        end = viewEnd;
+    if (end < m_size)
+        end &= ~(ULONGLONG)(sPageSize - 1);
+
+    batch.pData     = m_view + (m_pos - m_viewOffset);
+    batch.length    = (DWORD)(end - m_pos);
+    batch.isStream  = true;
+    batch.streamUsn = m_pos;
+    batch.nextUsn   = (USN)end;
+
+    m_bytesRead += batch.length;
+    m_batchCount++;
+    m_pos = end;
+    return true;
+}
@@ -0,0 +1,57 @@
+// ------------------------------------------------------------------------------------------------
+// Offline NTFS Journal reader.
+// Memory map an extracted $Extend\$UsnJrnl:$J stream and walk its USN records in place.
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+
+#include "Hnd.h"
+#include "JournalSource.h"
+
+class UsnFile : public JournalSource
+{
+public:
+    UsnFile(void);
+    ~UsnFile(void);
+
+    bool Open(const wchar_t* filePath);
+    void Close();
+    bool IsOpen() const
+    { return m_mapHnd != NULL; }
+
+    const wstring& GetPath() const
+    { return m_path; }
+
+    ULONGLONG GetSize() const
+    { return m_size; }
+
+    // JournalSource, batches point straight into the mapped view.
+    // Zero filled (sparse) journal before the first record is counted as skipped.
+    virtual bool Start(USN startUsn, DWORD reasonFilter);
+    virtual bool ReadBatch(JournalBatch& batch);
+
+    // Bytes handed out per batch.
+    static const DWORD sBatchSize = 1024 * 1024;
+
+private:
+    ULONGLONG FindFirstRecord(ULONGLONG usn);
+    bool QueryFirstAllocated(ULONGLONG offset, ULONGLONG& allocOffset) const;
+    bool IsZeroPage(ULONGLONG offset);
+    bool IsRecordRun(ULONGLONG page, ULONGLONG lastPage, unsigned pageCount);
+    bool MapView(ULONGLONG offset);
+
+private:
+    wstring                 m_path;
+    Hnd                     m_fileHnd;
+    HANDLE                  m_mapHnd;
+
+    // Active mapped view of $J stream.
+    const BYTE*             m_view;
+    ULONGLONG               m_viewOffset;
+    ULONGLONG               m_viewSize;
+    ULONGLONG               m_size;
+
+    ULONGLONG               m_pos;          // stream offset of next batch
+};
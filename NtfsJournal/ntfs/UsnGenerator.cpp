@@ -0,0 +1,460 @@
+// ------------------------------------------------------------------------------------------------
+// Synthetic NTFS Journal generator.
+// ------------------------------------------------------------------------------------------------
+
+#include <Windows.h>
+#include <stddef.h>
+#include <wctype.h>
+
+#include "UsnGenerator.h"
+#include "JournalSource.h"
+#include "ntfstypes.h"
+#include "winerrhandlers.h"
+
+static const DWORD sBufferSize = 1024 * 1024;     // multiple of journal page size
+static const DWORD sMaxDepth = 12;
+static const size_t sMaxLiveFiles = 1000000;      // bound memory, churn deletes instead
+
+// Root directory file id, record 5 sequence 5.
+static const DWORDLONG sRootFrn = ((DWORDLONG)5 << 48) | eMftRecRoot;
+
+static const wchar_t* sExtensions[] =
+{
+    L".txt", L".log", L".dll", L".exe", L".tmp", L".dat", L".json", L".xml",
+    L".cpp", L".h", L".obj", L".pdb", L".jpg", L".png", L".docx", L".etl",
+};
+
+static const DWORD sSecurityIds[] = { 0x100, 0x101, 0x10a, 0x115, 0x2f1, 0x30c };
+
+// ------------------------------------------------------------------------------------------------
+UsnGenerator::UsnGenerator(void) :
+    m_recordCount(1000000),
+    m_majorVersion(2),
+    m_rand(0x4e54464a6f75726eULL),
+    m_nextRecordNum(eMftRecFirstUser),
+    m_bufferUsed(0),
+    m_usn(0),
+    m_emitted(0),
+    m_ioError(false)
+{
+    m_timestamp.QuadPart = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+UsnGenerator::~UsnGenerator(void)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+void UsnGenerator::SaveLastError(DWORD error) const
+{
+    m_errorMsg = WinErrHandlers::LastErrorMsg(error);
+}
+
+// ------------------------------------------------------------------------------------------------
+// xorshift64*, fixed algorithm so a seed gives the same journal on every build.
+ULONGLONG UsnGenerator::Random()
+{
+    m_rand ^= m_rand >> 12;
+    m_rand ^= m_rand << 25;
+    m_rand ^= m_rand >> 27;
+    return m_rand * 2685821657736338717ULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool UsnGenerator::Generate(const wchar_t* outPath)
+{
+    if (m_majorVersion != 2 && m_majorVersion != 3)
+    {
+        SaveLastError(ERROR_INVALID_PARAMETER);
+        return false;
+    }
+
+    m_outHnd = CreateFile(outPath, GENERIC_WRITE,
+        FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (!m_outHnd.IsValid())
+    {
+        SaveLastError();
+        return false;
+    }
+
+    SYSTEMTIME baseTime = { 2026, 1, 4, 1, 8, 0, 0, 0 };
+    FILETIME fileTime;
+    SystemTimeToFileTime(&baseTime, &fileTime);
+    m_timestamp.LowPart = fileTime.dwLowDateTime;
+    m_timestamp.HighPart = fileTime.dwHighDateTime;
+
+    m_buffer.assign(sBufferSize, 0);
+    m_bufferUsed = 0;
+    m_usn = m_emitted = 0;
+    m_ioError = false;
+    m_nextRecordNum = eMftRecFirstUser;
+    m_dirs.clear();
+    m_dirIndex.clear();
+    m_files.clear();
+    m_freeFrns.clear();
+
+    Node root;
+    root.frn = root.parentFrn = sRootFrn;
+    root.depth = 0;
+    root.fileAttr = FILE_ATTRIBUTE_DIRECTORY;
+    root.children = 0;
+    m_dirIndex[root.frn] = m_dirs.size();
+    m_dirs.push_back(root);
+
+    while (m_emitted < m_recordCount && !m_ioError)
+    {
+        // Up to 2 seconds between operations.
+        m_timestamp.QuadPart += (LONGLONG)Random(2000) * 10000;
+
+        unsigned pick = Random(100);
+        if (m_files.empty() || pick < 20)
+            AddFile();
+        else if (pick < 60)
+            ModifyFile();
+        else if (pick < 72)
+            RemoveFile();
+        else if (pick < 82)
+            RenameFile();
+        else if (pick < 85)
+            AddDir();
+        else if (pick < 86)
+            RenameDir();
+        else if (pick < 87)
+            RemoveDir();
+        else if (pick < 90)
+            ChangeFile(USN_REASON_SECURITY_CHANGE);
+        else if (pick < 94)
+            ChangeFile(USN_REASON_BASIC_INFO_CHANGE);
+        else if (pick < 97)
+            ChangeFile(USN_REASON_NAMED_DATA_EXTEND | USN_REASON_STREAM_CHANGE);
+        else
+            ChangeFile(USN_REASON_HARD_LINK_CHANGE);
+    }
+
+    bool ok = !m_ioError && Flush();
+    m_outHnd = INVALID_HANDLE_VALUE;
+    return ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+// New file id, deleted ids are reused with their sequence number advanced.
+DWORDLONG UsnGenerator::AllocFrn()
+{
+    if (!m_freeFrns.empty() && Random(4) != 0)
+    {
+        size_t idx = Random((unsigned)m_freeFrns.size());
+        DWORDLONG frn = m_freeFrns[idx];
+        m_freeFrns[idx] = m_freeFrns.back();
+        m_freeFrns.pop_back();
+
+        WORD seq = (WORD)(frn >> 48) + 1;
+        if (seq == 0)
+            seq = 1;
+        return ((DWORDLONG)seq << 48) | (frn & sMftRecordMask);
+    }
+
+    return ((DWORDLONG)1 << 48) | m_nextRecordNum++;
+}
+
+// ------------------------------------------------------------------------------------------------
+void UsnGenerator::MakeName(wstring& name, bool isDir)
+{
+    static const wchar_t sChars[] = L"abcdefghijklmnopqrstuvwxyz0123456789_-";
+    static const wchar_t sVowels[] = L"aeiou";
+
+    // Mostly short names, some long generated ones (caches, build output).
+    unsigned length;
+    unsigned kind = Random(100);
+    if (kind < 70)
+        length = 3 + Random(10);
+    else if (kind < 95)
+        length = 12 + Random(20);
+    else
+        length = 32 + Random(100);
+
+    name.clear();
+    if (!isDir && Random(20) == 0)
+        name = L"~$";
+    for (unsigned idx = 0; idx < length; idx++)
+    {
+        if (kind < 70)
+            name += (idx & 1) ? sVowels[Random(5)] : sChars[Random(26)];
+        else
+            name += sChars[Random(ARRAYSIZE(sChars) - 1)];
+    }
+    if (Random(3) == 0)
+        name[0] = towupper(name[0]);
+
+    if (!isDir)
+        name += sExtensions[Random(ARRAYSIZE(sExtensions))];
+}
+
+// ------------------------------------------------------------------------------------------------
+// Random parent directory, weighted toward shallow directories.
+UsnGenerator::Node& UsnGenerator::PickDir()
+{
+    Node& dir1 = m_dirs[Random((unsigned)m_dirs.size())];
+    Node& dir2 = m_dirs[Random((unsigned)m_dirs.size())];
+    return (dir1.depth <= dir2.depth) ? dir1 : dir2;
+}
+
+// ------------------------------------------------------------------------------------------------
+void UsnGenerator::AddFile()
+{
+    if (m_files.size() >= sMaxLiveFiles)
+    {
+        RemoveFile();
+        return;
+    }
+
+    Node file;
+    Node& parent = PickDir();
+    parent.children++;
+    file.frn = AllocFrn();
+    file.parentFrn = parent.frn;
+    file.depth = parent.depth + 1;
+    file.fileAttr = (Random(10) == 0) ? (FILE_ATTRIBUTE_ARCHIVE | FILE_ATTRIBUTE_HIDDEN) : FILE_ATTRIBUTE_ARCHIVE;
+    file.children = 0;
+    MakeName(file.name, false);
+
+    Emit(file, USN_REASON_FILE_CREATE);
+    Emit(file, USN_REASON_FILE_CREATE | USN_REASON_DATA_EXTEND);
+    Emit(file, USN_REASON_FILE_CREATE | USN_REASON_DATA_EXTEND | USN_REASON_CLOSE);
+    m_files.push_back(file);
+}
+
+// ------------------------------------------------------------------------------------------------
+void UsnGenerator::AddDir()
+{
+    Node& parent = PickDir();
+    if (parent.depth >= sMaxDepth)
+    {
+        AddFile();
+        return;
+    }
+
+    Node dir;
+    parent.children++;
+    dir.frn = AllocFrn();
+    dir.parentFrn = parent.frn;
+    dir.depth = parent.depth + 1;
+    dir.fileAttr = FILE_ATTRIBUTE_DIRECTORY;
+    dir.children = 0;
+    MakeName(dir.name, true);
+
+    Emit(dir, USN_REASON_FILE_CREATE);
+    Emit(dir, USN_REASON_FILE_CREATE | USN_REASON_CLOSE);
+    m_dirIndex[dir.frn] = m_dirs.size();
+    m_dirs.push_back(dir);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Rename pair of a directory, so path caches have to follow it. A move only goes to a directory
+// at the depth of the old parent, which can not be inside the moved tree and keeps depths valid.
+void UsnGenerator::RenameDir()
+{
+    if (m_dirs.size() < 2)
+    {
+        AddDir();
+        return;
+    }
+
+    Node& dir = m_dirs[1 + Random((unsigned)m_dirs.size() - 1)];
+    Emit(dir, USN_REASON_RENAME_OLD_NAME);
+
+    if (Random(3) == 0)
+    {
+        Node& parent = PickDir();
+        if (parent.depth + 1 == dir.depth && parent.frn != dir.parentFrn)
+        {
+            GetDir(dir.parentFrn).children--;
+            parent.children++;
+            dir.parentFrn = parent.frn;
+        }
+    }
+    MakeName(dir.name, true);
+
+    Emit(dir, USN_REASON_RENAME_NEW_NAME);
+    Emit(dir, USN_REASON_RENAME_NEW_NAME | USN_REASON_CLOSE);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Delete a directory once its files and subdirectories are gone, as the file system requires.
+void UsnGenerator::RemoveDir()
+{
+    size_t idx = 0;
+    for (unsigned tries = 0; tries < 8 && m_dirs.size() > 1; tries++)
+    {
+        size_t pick = 1 + Random((unsigned)m_dirs.size() - 1);
+        if (m_dirs[pick].children == 0)
+        {
+            idx = pick;
+            break;
+        }
+    }
+    if (idx == 0)
+    {
+        RenameDir();
+        return;
+    }
+
+    const Node& dir = m_dirs[idx];
+    Emit(dir, USN_REASON_FILE_DELETE | USN_REASON_CLOSE);
+    GetDir(dir.parentFrn).children--;
+
+    m_freeFrns.push_back(dir.frn);
+    m_dirIndex.erase(dir.frn);
+    if (idx + 1 != m_dirs.size())
+    {
+        m_dirs[idx] = m_dirs.back();
+        m_dirIndex[m_dirs[idx].frn] = idx;
+    }
+    m_dirs.pop_back();
+}
+
+// ------------------------------------------------------------------------------------------------
+void UsnGenerator::ModifyFile()
+{
+    const Node& file = m_files[Random((unsigned)m_files.size())];
+    DWORD reason = (Random(3) == 0) ? USN_REASON_DATA_TRUNCATION : USN_REASON_DATA_OVERWRITE;
+
+    Emit(file, reason);
+    reason |= USN_REASON_DATA_EXTEND;
+    Emit(file, reason);
+    Emit(file, reason | USN_REASON_CLOSE);
+}
+
+// ------------------------------------------------------------------------------------------------
+void UsnGenerator::RemoveFile()
+{
+    size_t idx = Random((unsigned)m_files.size());
+    const Node& file = m_files[idx];
+
+    if (Random(2) == 0)
+        Emit(file, USN_REASON_BASIC_INFO_CHANGE);
+    Emit(file, USN_REASON_FILE_DELETE | USN_REASON_CLOSE);
+    GetDir(file.parentFrn).children--;
+
+    m_freeFrns.push_back(file.frn);
+    m_files[idx] = m_files.back();
+    m_files.pop_back();
+}
+
+// ------------------------------------------------------------------------------------------------
+// Rename pair, old name then new name, sometimes moved to another directory.
+void UsnGenerator::RenameFile()
+{
+    Node& file = m_files[Random((unsigned)m_files.size())];
+    Emit(file, USN_REASON_RENAME_OLD_NAME);
+
+    if (Random(3) == 0)
+    {
+        Node& parent = PickDir();
+        GetDir(file.parentFrn).children--;
+        parent.children++;
+        file.parentFrn = parent.frn;
+        file.depth = parent.depth + 1;
+    }
+    MakeName(file.name, false);
+
+    Emit(file, USN_REASON_RENAME_NEW_NAME);
+    Emit(file, USN_REASON_RENAME_NEW_NAME | USN_REASON_CLOSE);
+}
+
+// ------------------------------------------------------------------------------------------------
+void UsnGenerator::ChangeFile(DWORD reason)
+{
+    const Node& file = m_files[Random((unsigned)m_files.size())];
+    Emit(file, reason);
+    Emit(file, reason | USN_REASON_CLOSE);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Append record at current USN, zero pad to next page if it does not fit.
+void UsnGenerator::Emit(const Node& node, DWORD reason)
+{
+    if (m_emitted >= m_recordCount || m_ioError)
+        return;
+
+    const DWORD pageSize = JournalSource::sPageSize;
+    DWORD nameOffset = (m_majorVersion == 2)
+        ? (DWORD)offsetof(USN_RECORD_V2, FileName) : (DWORD)offsetof(USN_RECORD_V3, FileName);
+    DWORD nameBytes = (DWORD)(node.name.length() * sizeof(wchar_t));
+    DWORD recordLength = (nameOffset + nameBytes + 7) & ~7;
+
+    // Keep room for page padding plus record.
+    if (m_bufferUsed + 2 * pageSize > sBufferSize && !Flush())
+        return;
+
+    DWORD pageUsed = (DWORD)(m_usn % pageSize);
+    if (pageUsed + recordLength > pageSize)
+    {
+        DWORD pad = pageSize - pageUsed;
+        m_bufferUsed += pad;        // buffer is zeroed after every flush
+        m_usn += pad;
+    }
+
+    BYTE* pRecord = &m_buffer[m_bufferUsed];
+    DWORD securityId = sSecurityIds[Random(ARRAYSIZE(sSecurityIds))];
+    if (m_majorVersion == 2)
+    {
+        USN_RECORD_V2* pV2 = (USN_RECORD_V2*)pRecord;
+        pV2->RecordLength = recordLength;
+        pV2->MajorVersion = 2;
+        pV2->MinorVersion = 0;
+        pV2->FileReferenceNumber = node.frn;
+        pV2->ParentFileReferenceNumber = node.parentFrn;
+        pV2->Usn = (USN)m_usn;
+        pV2->TimeStamp = m_timestamp;
+        pV2->Reason = reason;
+        pV2->SourceInfo = 0;
+        pV2->SecurityId = securityId;
+        pV2->FileAttributes = node.fileAttr;
+        pV2->FileNameLength = (WORD)nameBytes;
+        pV2->FileNameOffset = (WORD)nameOffset;
+    }
+    else
+    {
+        USN_RECORD_V3* pV3 = (USN_RECORD_V3*)pRecord;
+        pV3->RecordLength = recordLength;
+        pV3->MajorVersion = 3;
+        pV3->MinorVersion = 0;
+        ZeroMemory(&pV3->FileReferenceNumber, sizeof(pV3->FileReferenceNumber));
+        ZeroMemory(&pV3->ParentFileReferenceNumber, sizeof(pV3->ParentFileReferenceNumber));
+        memcpy(pV3->FileReferenceNumber.Identifier, &node.frn, sizeof(node.frn));
+        memcpy(pV3->ParentFileReferenceNumber.Identifier, &node.parentFrn, sizeof(node.parentFrn));
+        pV3->Usn = (USN)m_usn;
+        pV3->TimeStamp = m_timestamp;
+        pV3->Reason = reason;
+        pV3->SourceInfo = 0;
+        pV3->SecurityId = securityId;
+        pV3->FileAttributes = node.fileAttr;
+        pV3->FileNameLength = (WORD)nameBytes;
+        pV3->FileNameOffset = (WORD)nameOffset;
+    }
+    memcpy(pRecord + nameOffset, node.name.c_str(), nameBytes);
+
+    m_bufferUsed += recordLength;
+    m_usn += recordLength;
+    m_emitted++;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool UsnGenerator::Flush()
+{
+    if (m_bufferUsed == 0)
+        return true;
+
+    DWORD written;
+    if (!WriteFile(m_outHnd, &m_buffer[0], m_bufferUsed, &written, NULL) || written != m_bufferUsed)
+    {
+        SaveLastError();
+        m_ioError = true;
+        return false;
+    }
+
+    ZeroMemory(&m_buffer[0], m_bufferUsed);
+    m_bufferUsed = 0;
+    return true;
+}
@@ -0,0 +1,99 @@
+// ------------------------------------------------------------------------------------------------
+// Synthetic NTFS Journal generator.
+// Write a $UsnJrnl:$J stream of USN_RECORD_V2 or V3 records for scale and throughput tests.
+// Records follow the on-disk layout (USN is stream offset, records never span a page),
+// so output is read by any offline journal reader (-j).
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Hnd.h"
+
+using namespace std;
+
+class UsnGenerator
+{
+public:
+    UsnGenerator(void);
+    ~UsnGenerator(void);
+
+    void SetRecordCount(ULONGLONG recordCount)
+    { m_recordCount = recordCount; }
+
+    // 2 = USN_RECORD_V2 (64bit file id), 3 = USN_RECORD_V3 (128bit file id)
+    void SetMajorVersion(WORD majorVersion)
+    { m_majorVersion = majorVersion; }
+
+    // Same seed and settings always produce the same journal.
+    void SetSeed(ULONGLONG seed)
+    { m_rand = (seed != 0) ? seed : 1; }
+
+    bool Generate(const wchar_t* outPath);
+
+    ULONGLONG GetBytesWritten() const
+    { return m_usn; }
+
+    wstring GetLastErrorMsg() const
+    { return m_errorMsg; }
+
+private:
+    struct Node
+    {
+        DWORDLONG   frn;
+        DWORDLONG   parentFrn;
+        wstring     name;
+        unsigned    depth;
+        DWORD       fileAttr;
+        unsigned    children;   // directory, live files and directories inside
+    };
+
+    // Journal activity, each emits a realistic sequence of records.
+    void AddFile();
+    void AddDir();
+    void RenameDir();
+    void RemoveDir();
+    void ModifyFile();
+    void RemoveFile();
+    void RenameFile();
+    void ChangeFile(DWORD reason);
+
+    DWORDLONG AllocFrn();
+    void MakeName(wstring& name, bool isDir);
+    Node& PickDir();
+    Node& GetDir(DWORDLONG frn)
+    { return m_dirs[m_dirIndex[frn]]; }
+
+    void Emit(const Node& node, DWORD reason);
+    bool Flush();
+
+    ULONGLONG Random();
+    unsigned Random(unsigned range)
+    { return (unsigned)(Random() % range); }
+
+    void SaveLastError(DWORD error=0) const;
+
+private:
+    Hnd                     m_outHnd;
+    mutable wstring         m_errorMsg;
+
+    ULONGLONG               m_recordCount;
+    WORD                    m_majorVersion;
+    ULONGLONG               m_rand;
+
+    std::vector<Node>       m_dirs;         // root first
+    std::unordered_map<DWORDLONG, size_t> m_dirIndex;  // directory file id to m_dirs index
+    std::vector<Node>       m_files;
+    std::vector<DWORDLONG>  m_freeFrns;     // deleted file ids, reused with next sequence
+    ULONGLONG               m_nextRecordNum;
+
+    std::vector<BYTE>       m_buffer;
+    DWORD                   m_bufferUsed;
+    ULONGLONG               m_usn;
+    ULONGLONG               m_emitted;
+    LARGE_INTEGER           m_timestamp;
+    bool                    m_ioError;
+};
@@ -10,6 +10,8 @@
 #include <iostream>
 
 #include "Ntfs.h"
+#include "SysShim.h"
+#include "TimeFormatter.h"
 #include "fsutil.h"
 #include "winerrhandlers.h"
 
@@ -19,7 +21,15 @@ const wchar_t sSlashStr[] = L"\\";
 Ntfs::Ntfs(void) : 
     m_drive('c'),
     m_nextUsn(0),
-    m_filter(sDefaultFilter)
+    m_filter(sDefaultFilter),
+    m_preFilterCb(NULL),
+    m_preFilterData(NULL),
+    m_useJournalTree(false),
+    m_volumeLookup(false),
+    m_pMftTable(NULL),
+    m_cacheUsn(0),
+    m_liveUsn(0),
+    m_lookupThreads(LookupPool::sAutoThreads)
 {
 }
 
@@ -52,13 +62,14 @@ bool Ntfs::OpenDrive(wchar_t driveLetter)
     */
 
     m_drive = driveLetter;
-    m_fileInfoCache.clear();
+    m_pathStore.Clear();
+    m_cacheUsn = 0;
+    m_journalTree.Clear();
  
 
     TCHAR szVolumePath[MAX_PATH];
     wsprintf(szVolumePath, TEXT("\\\\.\\%C:"), m_drive);
-    m_volHnd = CreateFile(szVolumePath, GENERIC_READ,
-        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    m_volHnd = SysShim::OpenVolume(szVolumePath);
 
     if (m_volHnd == INVALID_HANDLE_VALUE) 
          SaveLastError();				
@@ -117,49 +128,27 @@ bool Ntfs::HasJournal() const
 // ------------------------------------------------------------------------------------------------
 bool Ntfs::GetJournal(HandleRecordCb handleCb, void* cbData, USN startUsn, DWORD filter, bool getFileLength, bool getFullPath)
 {
-    USN_JOURNAL_DATA usnJournalData;
-
-    if (!QueryJournal(usnJournalData))
-        return false;
-    
-    SetFilter(filter == 0 ? sDefaultFilter : filter);
-	m_nextUsn = (startUsn == 0) ? usnJournalData.FirstUsn : startUsn;
-
-    while (ReadJournal(
-        m_nextUsn,
-        usnJournalData.UsnJournalID,
-        handleCb, 
-        cbData,
-        NULL,
-        getFileLength, getFullPath))
-    {
-        // usn is populated with USN after records processed.
-    }
-
-    return true;
+    VolumeSource source(m_volHnd);
+    return ReadJournal(source, startUsn, filter, handleCb, cbData, NULL, getFileLength, getFullPath);
 }
 
 // ------------------------------------------------------------------------------------------------
 bool Ntfs::GetJournal(JournalList& list, USN startUsn, DWORD filter, bool getFileLength, bool getFullPath)
 {
-	USN_JOURNAL_DATA usnJournalData;
-
-    if (!QueryJournal(usnJournalData))
-        return false;
-    
-    SetFilter(filter == 0 ? sDefaultFilter : filter);
-	m_nextUsn = (startUsn == 0) ? usnJournalData.FirstUsn : startUsn;
+    VolumeSource source(m_volHnd);
+    return ReadJournal(source, startUsn, filter, NULL, NULL, &list, getFileLength, getFullPath);
+}
 
-    while (ReadJournal(
-        m_nextUsn,
-        usnJournalData.UsnJournalID,
-        NULL, NULL,
-        &list, getFileLength, getFullPath))
-    {
-        // usn is populated with USN after records processed.
-    }
+// ------------------------------------------------------------------------------------------------
+bool Ntfs::GetJournal(JournalSource& source, HandleRecordCb handleCb, void* cbData, USN startUsn, DWORD filter, bool getFileLength, bool getFullPath)
+{
+    return ReadJournal(source, startUsn, filter, handleCb, cbData, NULL, getFileLength, getFullPath);
+}
 
-    return true;
+// ------------------------------------------------------------------------------------------------
+bool Ntfs::GetJournal(JournalSource& source, JournalList& list, USN startUsn, DWORD filter, bool getFileLength, bool getFullPath)
+{
+    return ReadJournal(source, startUsn, filter, NULL, NULL, &list, getFileLength, getFullPath);
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -211,8 +200,8 @@ bool Ntfs::QueryJournal(USN_JOURNAL_DATA& usnJournalData) const
         &v2, sizeof(v2), &cb, NULL));
     */
 
-    bool ok = (TRUE == DeviceIoControl(m_volHnd, FSCTL_QUERY_USN_JOURNAL, NULL, 0, 
-        &usnJournalData, sizeof(usnJournalData), &cb, NULL));
+    bool ok = (TRUE == SysShim::DeviceIoControl(m_volHnd, FSCTL_QUERY_USN_JOURNAL, NULL, 0, 
+        &usnJournalData, sizeof(usnJournalData), &cb));
 
     if (!ok) 
          SaveLastError();
@@ -222,116 +211,168 @@ bool Ntfs::QueryJournal(USN_JOURNAL_DATA& usnJournalData) const
 
 // ------------------------------------------------------------------------------------------------
 bool Ntfs::ReadJournal(
-        USN& usn,               // usn to start reading, on exit set to usn to resume reading.
-        DWORDLONG UsnJournalID, 
+        JournalSource& source,
+        USN startUsn,
+        DWORD filter,
         HandleRecordCb handleCb,
         void* cbData,
-        JournalList* pList, 
+        JournalList* pList,
         bool getFileLength,
-        bool getFullPath,
-        unsigned maxRecords)
+        bool getFullPath)
 {
-    BOOL retval = TRUE;
+    SetFilter(filter == 0 ? sDefaultFilter : filter);
 
-    DWORD bytesRead;
-    JournalRecord record;
+    // Journal tree follows every named record, not just the reported ones.
+    // Path cache follows directory renames.
+    DWORD sourceFilter = m_useJournalTree ? ~(DWORD)0
+        : (m_filter | USN_REASON_RENAME_OLD_NAME | USN_REASON_RENAME_NEW_NAME);
+    if (!source.Start(startUsn, sourceFilter))
+    {
+        m_errorMsg = source.GetLastErrorMsg();
+        return false;
+    }
 
-    m_buffer.resize(sizeof(USN) + sizeof(USN_RECORD) * maxRecords);
-    byte* pBuffer = &m_buffer[0];
+    // Paths and lengths can only be looked up on the volume which produced the records.
+    m_volumeLookup = source.IsVolume() && IsOpen();
+    if (!m_volumeLookup && m_pMftTable == NULL)
+    {
+        getFileLength = false;
+        if (!m_useJournalTree)
+            getFullPath = false;
+    }
 
-    /*
-    *      READ_USN_JOURNAL_DATA
-                USN StartUsn;
-                DWORD ReasonMask;
-                DWORD ReturnOnlyOnClose;
-                DWORDLONG Timeout;
-                DWORDLONG BytesToWaitFor;
-                DWORDLONG UsnJournalID;
-                WORD   MinMajorVersion;
-                WORD   MaxMajorVersion;
-    */
-    READ_USN_JOURNAL_DATA usnData;
-    ZeroMemory(&usnData, sizeof(usnData));
-    usnData.StartUsn        = usn;		
-    usnData.ReasonMask      = m_filter;	
-    usnData.UsnJournalID    = UsnJournalID; 
-    usnData.BytesToWaitFor  = 0;    // m_buffer.capacity();
-    usnData.MaxMajorVersion = 2;
-
-    // Get some records from the journal
-    retval = DeviceIoControl(m_volHnd, FSCTL_READ_USN_JOURNAL, &usnData, sizeof(usnData), 
-            pBuffer, (DWORD)m_buffer.capacity(), &bytesRead, NULL);
-
-    // We are finished if DeviceIoControl fails, or the number of bytes
-    // returned is < sizeof(USN).  
-    if (!retval || bytesRead <= sizeof(USN)) 
+    // Volume lookups of each batch run on worker threads.
+    if (m_volumeLookup && !m_useJournalTree && (getFullPath || getFileLength))
+        m_lookupPool.Start(m_lookupThreads);
+
+    // Paths looked up now already hold every rename written so far. An $MFT table is a
+    // snapshot taken after the records it is paired with.
+    USN_JOURNAL_DATA journalData;
+    m_liveUsn = (m_volumeLookup && QueryJournal(journalData)) ? journalData.NextUsn : MAXLONGLONG;
+
+    m_nextUsn = startUsn;
+    JournalBatch batch;
+    while (source.ReadBatch(batch))
     {
-        SaveLastError();
+        DecodeBatch(batch, handleCb, cbData, pList, getFileLength, getFullPath);
+
+        // Pass USN to resume reading to caller.
+        m_nextUsn = batch.nextUsn;
+    }
+
+    if (source.HasFailed())
+    {
+        m_errorMsg = source.GetLastErrorMsg();
         return false;
     }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return record at or after pos, NULL at end of batch.
+static const USN_RECORD_COMMON_HEADER* FindRecord(const JournalBatch& batch, DWORD& pos)
+{
+    const ULONGLONG pageMask = ~(ULONGLONG)(JournalSource::sPageSize - 1);
+    while (pos + sizeof(USN_RECORD_COMMON_HEADER) <= batch.length)
+    {
+        const USN_RECORD_COMMON_HEADER* pHeader = (const USN_RECORD_COMMON_HEADER*)(batch.pData + pos);
+        ULONGLONG usn = batch.isStream ? batch.streamUsn + pos : (ULONGLONG)JournalSource::GetRecordUsn(pHeader);
+        if (JournalSource::IsValidRecord(pHeader, usn, batch.length - pos))
+            return pHeader;
+
+        // Live journal records are packed, stream zero fill or damage resumes on next page.
+        if (!batch.isStream)
+            break;
+        pos = (DWORD)(((usn + JournalSource::sPageSize) & pageMask) - batch.streamUsn);
+    }
+    return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Walk records of one batch in place, shared by all journal sources.
+void Ntfs::DecodeBatch(
+        const JournalBatch& batch,
+        HandleRecordCb handleCb,
+        void* cbData,
+        JournalList* pList,
+        bool getFileLength,
+        bool getFullPath)
+{
+    JournalRecord record;
+    std::wstring fullPath;
 
     GetInfo getFileInfo = (getFileLength ? eGetLength : eGetPath);
 
-    // Pass USN to resume reading to caller.
-    usn = *(USN*)pBuffer;
+    if (m_volumeLookup && m_lookupPool.GetThreadCount() != 0 && !m_useJournalTree && (getFullPath || getFileLength))
+        PrefetchBatch(batch, getFileLength);
 
-    // The first returned record is just after the first sizeof(USN) bytes
-    USN_RECORD* pUsnRecord = (PUSN_RECORD) (pBuffer + sizeof(USN));
+    // Last named (V2/V3) record, supplies name of following V4 range records.
+    const USN_RECORD_COMMON_HEADER* pNamed = NULL;
 
-    // Walk the output buffer
-    while ((PBYTE) pUsnRecord < (pBuffer + bytesRead)) 
+    // Walk the batch buffer
+    DWORD pos = 0;
+    const USN_RECORD_COMMON_HEADER* pHeader;
+    while ((pHeader = FindRecord(batch, pos)) != NULL)
     {
-        LPWSTR pszFileName = (LPWSTR)((PBYTE) pUsnRecord  + pUsnRecord->FileNameOffset);
-        // Create a zero terminated copy of the filename
-        WCHAR szFile[MAX_PATH];
-        int cFileName = pUsnRecord->FileNameLength / sizeof(WCHAR);
-        wcsncpy_s(szFile, MAX_PATH, pszFileName, cFileName);
-        szFile[cFileName] = 0;
-
-        /*
-        	    USN				m_usn;
-	            DWORD			m_reason;
-	            DWORDLONG		m_fileId;
-	            LARGE_INTEGER	m_timestamp;
-                LARGE_INTEGER   m_length;
-                DWORD           m_fileAttr;
-	            wstring			m_filename;
-        */
-        record.m_filename.clear();
-        record.m_usn        = pUsnRecord->Usn;
-        record.m_reason     = pUsnRecord->Reason;
-        record.m_fileId     = pUsnRecord->FileReferenceNumber;
-        record.m_timestamp  = pUsnRecord->TimeStamp;
-        record.m_fileAttr   = pUsnRecord->FileAttributes;
-        record.m_length.QuadPart = 0;
-
-        if (getFullPath || getFileLength) 
-        { 
-            if ((record.m_fileAttr & FILE_ATTRIBUTE_DIRECTORY)) 
+        pos += pHeader->RecordLength;
+
+        DWORD reason = JournalSource::GetRecordReason(pHeader);
+        bool isNamed = (pHeader->MajorVersion != 4);
+        if (isNamed)
+            pNamed = pHeader;
+
+        // Range records follow the record of the same file which names it.
+        const USN_RECORD_COMMON_HEADER* pNaming = NULL;
+        if (!isNamed && pNamed != NULL && JournalSource::GetRecordFileRef(pNamed) == JournalSource::GetRecordFileRef(pHeader))
+            pNaming = pNamed;
+        RecordView view(pHeader, pNaming, record);
+
+        if (isNamed)
+        {
+            if (m_useJournalTree)
+            {
+                view.Decode();
+                m_journalTree.Apply(record.m_fileId, record.m_parentId, record.m_filename);
+            }
+            else if ((reason & (USN_REASON_RENAME_OLD_NAME | USN_REASON_RENAME_NEW_NAME)) != 0
+                && m_pathStore.GetFileCount() != 0 && view.IsDirectory())
+            {
+                RenameCachedDir(view.Decode());
+            }
+        }
+
+        if ((reason & m_filter) == 0)
+            continue;
+        if (m_preFilterCb != NULL && !m_preFilterCb(view, m_preFilterData))
+            continue;
+
+        // Resolved path is built in fullPath and swapped in, both buffers are reused.
+        view.Decode();
+        if (m_useJournalTree)
+        {
+            if (getFullPath && GetTreePath(record.m_fileId, fullPath))
+                record.m_filename.swap(fullPath);
+            if (getFileLength && (record.m_fileAttr & FILE_ATTRIBUTE_DIRECTORY) == 0)
+                GetFileInfo(record.m_fileId, eGetLength, fullPath, record.m_length);
+        }
+        else if (getFullPath || getFileLength)
+        {
+            if ((record.m_fileAttr & FILE_ATTRIBUTE_DIRECTORY))
             {
-                if (GetDirInfo(pUsnRecord->ParentFileReferenceNumber, record.m_filename)) {
-                    record.m_filename = record.m_filename + sSlashStr + szFile;
+                if (GetDirInfo(record.m_parentId, fullPath)) {
+                    fullPath += sSlashStr;
+                    fullPath += record.m_filename;
+                    record.m_filename.swap(fullPath);
                     record.m_length.QuadPart = 0;   // TODO - populate file length !
-                } else {
-                    record.m_filename = szFile;
                 }
             }
-            else if (!GetFileInfo(pUsnRecord->FileReferenceNumber, getFileInfo, record.m_filename, record.m_length))
+            else if (GetFileInfo(record.m_fileId, getFileInfo, fullPath, record.m_length))
             {
-                // record.m_filename = L"?\\";
-                // record.m_filename = L"";
-                record.m_filename = szFile;
+                record.m_filename.swap(fullPath);
             }
-        } 
-        else 
-        {
-            record.m_filename = szFile;
         }
 
         const DWORD eDirectory = 0x10;
-        // if (isDir)
-        //    record.m_fileAttr |= eDirectory;
-
         if ((eDirectory & record.m_fileAttr) != 0)
             record.m_filename += sSlashStr;
 
@@ -339,12 +380,194 @@ bool Ntfs::ReadJournal(
             pList->push_back(record);
         if (handleCb != NULL)
             handleCb(record, cbData);
+    }
+
+    m_lookups.clear();
+    m_lookupIndex.clear();
+}
+
+// ------------------------------------------------------------------------------------------------
+// Gather unique ids the batch will look up and resolve them together on the lookup pool.
+// DecodeBatch then takes their results in usn order, ids missed here are looked up inline.
+void Ntfs::PrefetchBatch(const JournalBatch& batch, bool getFileLength)
+{
+    JournalRecord record;
+    DWORD pos = 0;
+    const USN_RECORD_COMMON_HEADER* pHeader;
+    while ((pHeader = FindRecord(batch, pos)) != NULL)
+    {
+        pos += pHeader->RecordLength;
+        if (pHeader->MajorVersion == 4 || (JournalSource::GetRecordReason(pHeader) & m_filter) == 0)
+            continue;
+
+        // Same lookups as DecodeBatch, directories by parent (cached), files by id.
+        RecordView view(pHeader, NULL, record);
+        if (m_preFilterCb != NULL && !m_preFilterCb(view, m_preFilterData))
+            continue;
+
+        if (view.IsDirectory())
+        {
+            FileRef parentId = view.GetParentId();
+            if (!m_pathStore.HasFile(parentId))
+                AddLookup(parentId, false);
+        }
+        else
+        {
+            AddLookup(view.GetFileId(), getFileLength);
+        }
+    }
+
+    m_lookupPool.Resolve(m_volHnd, m_pMftTable, m_lookups);
+}
+
+// ------------------------------------------------------------------------------------------------
+void Ntfs::AddLookup(const FileRef& fileId, bool getLength)
+{
+    std::pair<LookupIndex::iterator, bool> result =
+        m_lookupIndex.insert(LookupIndex::value_type(fileId, m_lookups.size()));
+    if (!result.second)
+    {
+        m_lookups[result.first->second].getLength |= getLength;
+        return;
+    }
+
+    m_lookups.resize(m_lookups.size() + 1);
+    LookupPool::Lookup& lookup = m_lookups.back();
+    lookup.fileId = fileId;
+    lookup.getLength = getLength;
+    lookup.status = 0;
+    lookup.allocatedSize.QuadPart = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Resolve path from journal tree, return false if file was never named in journal.
+// Directories older than the journal are looked up once on the volume and added to the tree,
+// offline they are reported as \#<fileId>.
+
+bool Ntfs::GetTreePath(const FileRef& fileId, std::wstring& fullPath)
+{
+    FileRef unknownId;
+    if (m_journalTree.GetPath(fileId, fullPath, unknownId))
+        return true;
+    if (unknownId == fileId)
+        return false;
+
+    std::wstring dirPath;
+    if ((m_volumeLookup || m_pMftTable != NULL) && GetDirInfo(unknownId, dirPath))
+    {
+        m_journalTree.AddDir(unknownId, dirPath);
+        fullPath.insert(0, dirPath);
+    }
+    else
+    {
+        wchar_t idStr[40];
+        if (unknownId.Is64())
+            swprintf_s(idStr, ARRAYSIZE(idStr), L"\\#%llx", unknownId.low);
+        else
+            swprintf_s(idStr, ARRAYSIZE(idStr), L"\\#%llx%016llx", unknownId.high, unknownId.low);
+        fullPath.insert(0, idStr);
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+Ntfs::RecordView::RecordView(const USN_RECORD_COMMON_HEADER* pHeader, const USN_RECORD_COMMON_HEADER* pNamed,
+        JournalRecord& record) :
+    m_pHeader(pHeader),
+    m_pNamed(pNamed),
+    m_record(record),
+    m_isDecoded(false)
+{
+}
+
+// ------------------------------------------------------------------------------------------------
+Ntfs::JournalRecord& Ntfs::RecordView::Decode() const
+{
+    if (m_isDecoded)
+        return m_record;
 
-        // Move to next record
-        pUsnRecord = (PUSN_RECORD)  ((PBYTE) pUsnRecord + pUsnRecord->RecordLength);
+    if (m_pHeader->MajorVersion == 4)
+    {
+        m_record.m_filename.clear();
+        m_record.m_timestamp.QuadPart = 0;
+        m_record.m_fileAttr = 0;
+        if (m_pNamed != NULL)
+            DecodeRecord(m_pNamed, m_record);
     }
+    DecodeRecord(m_pHeader, m_record);
+    m_isDecoded = true;
+    return m_record;
+}
 
-    return true;        // TODO - return false if less than 100 record meaning done, else true meaning more data.
+// ------------------------------------------------------------------------------------------------
+void Ntfs::DecodeRecord(const USN_RECORD_COMMON_HEADER* pHeader, JournalRecord& record)
+{
+    /*
+            USN				m_usn;
+            DWORD			m_reason;
+            FileRef 		m_fileId;
+            FileRef 		m_parentId;
+            LARGE_INTEGER	m_timestamp;
+            LARGE_INTEGER   m_length;
+            DWORD           m_fileAttr;
+            wstring			m_filename;
+            ExtentList      m_extents;
+    */
+    record.m_length.QuadPart = 0;
+    record.m_extents.clear();
+
+    LPCWSTR pszFileName;
+    WORD fileNameLength;
+
+    switch (pHeader->MajorVersion)
+    {
+    case 2:
+    default:
+        {
+        const USN_RECORD_V2* pV2 = (const USN_RECORD_V2*)pHeader;
+        record.m_usn        = pV2->Usn;
+        record.m_reason     = pV2->Reason;
+        record.m_fileId     = pV2->FileReferenceNumber;
+        record.m_parentId   = pV2->ParentFileReferenceNumber;
+        record.m_timestamp  = pV2->TimeStamp;
+        record.m_fileAttr   = pV2->FileAttributes;
+        pszFileName = (LPCWSTR)((const BYTE*)pV2 + pV2->FileNameOffset);
+        fileNameLength = pV2->FileNameLength;
+        }
+        break;
+
+    case 3:
+        {
+        const USN_RECORD_V3* pV3 = (const USN_RECORD_V3*)pHeader;
+        record.m_usn        = pV3->Usn;
+        record.m_reason     = pV3->Reason;
+        record.m_fileId     = pV3->FileReferenceNumber;
+        record.m_parentId   = pV3->ParentFileReferenceNumber;
+        record.m_timestamp  = pV3->TimeStamp;
+        record.m_fileAttr   = pV3->FileAttributes;
+        pszFileName = (LPCWSTR)((const BYTE*)pV3 + pV3->FileNameOffset);
+        fileNameLength = pV3->FileNameLength;
+        }
+        break;
+
+    case 4:
+        {
+        // Range tracking record, no name, time or attributes.
+        const USN_RECORD_V4* pV4 = (const USN_RECORD_V4*)pHeader;
+        record.m_usn        = pV4->Usn;
+        record.m_reason     = pV4->Reason;
+        record.m_fileId     = pV4->FileReferenceNumber;
+        record.m_parentId   = pV4->ParentFileReferenceNumber;
+
+        const BYTE* pExtent = (const BYTE*)pV4->Extents;
+        for (WORD idx = 0; idx < pV4->NumberOfExtents; idx++, pExtent += pV4->ExtentSize)
+            record.m_extents.push_back(*(const USN_RECORD_EXTENT*)pExtent);
+        }
+        return;
+    }
+
+    // Filename is not zero terminated.
+    record.m_filename.assign(pszFileName, fileNameLength / sizeof(WCHAR));
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -402,201 +625,173 @@ const wchar_t* Ntfs::GetReasonString(DWORD dwReason,  std::wstring& outReasonStr
 }
 
 // ------------------------------------------------------------------------------------------------
+// Single timestamp as local "date time", reports use a TimeFormatter compiled once instead.
 const wchar_t* Ntfs::GetTimestamp(
     const LARGE_INTEGER& timestamp, 
     std::wstring& outDateTimeStr,
     const wchar_t* dateFmt,
     const wchar_t* timeFmt)
 {
-    SYSTEMTIME systemTime;
-    FileTimeToSystemTime((FILETIME*)&timestamp, &systemTime);
-
-    // Convert system time to local time
-    SYSTEMTIME localTime;
-    SystemTimeToTzSpecificLocalTime(NULL, &systemTime, &localTime);
-
-    const int sMaxTimeLen = 64;
-    wchar_t dateTimeStr[sMaxTimeLen];
-
-    // Get formatted date.
-    // D	Day of month as digits with no leading zero for single-digit days.
-    // Dd	Day of month as digits with leading zero for single-digit days.
-    // Ddd	Day of week as a three-letter abbreviation. The function uses the 
-    //      LOCALE_SABBREVDAYNAME value associated with the specified locale.
-    // Dddd	Day of week as its full name. The function uses the LOCALE_SDAYNAME 
-    //      value associated with the specified locale.
-    // M	Month as digits with no leading zero for single-digit months.
-    // MM	Month as digits with leading zero for single-digit months.
-    // MMM	Month as a three-letter abbreviation. The function uses the 
-    //      LOCALE_SABBREVMONTHNAME value associated with the specified locale.
-    // MMMM	Month as its full name. The function uses the LOCALE_SMONTHNAME 
-    //      value associated with the specified locale.
-    // y	Year as last two digits, with a leading zero for years less than 10. 
-    //      The same format as "yy."
-    // yy	Year as last two digits, with a leading zero for years less than 10.
-    // yyyy	Year represented by full four digits.
-    // gg	Period/era string. The function uses the CAL_SERASTRING value 
-    //      associated with the specified locale. This element is ignored if the date 
-    //      to be formatted does not have an associated era or period string.
-    int cch = GetDateFormatW(
-            (MAKELCID(MAKELANGID(LANG_ENGLISH, SUBLANG_ENGLISH_AUS), SORT_DEFAULT)), 
-            0,  // DATE_SHORTDATE, 
-            &localTime, 
-            dateFmt,
-            dateTimeStr, sMaxTimeLen);
-    dateTimeStr[cch] = 0;
-    DWORD err = GetLastError();
-
-    outDateTimeStr = dateTimeStr;
-    outDateTimeStr += L" ";
-
-    // Get formatted time
-    //  h   Hours with no leading zero for single-digit hours; 12-hour clock
-    //  hh	Hours with leading zero for single-digit hours; 12-hour clock
-    //  H	Hours with no leading zero for single-digit hours; 24-hour clock
-    //  HH	Hours with leading zero for single-digit hours; 24-hour clock
-    //  m	Minutes with no leading zero for single-digit minutes
-    //  mm	Minutes with leading zero for single-digit minutes
-    //  s	Seconds with no leading zero for single-digit seconds
-    //  ss	Seconds with leading zero for single-digit seconds
-    //  t	One character time marker string, such as A or P
-    //  tt	Multicharacter time marker string, such as AM or PM
-    cch = GetTimeFormat(
-            LOCALE_USER_DEFAULT, 
-            0,
-            &localTime, 
-            timeFmt, 
-            dateTimeStr, sMaxTimeLen);
-    dateTimeStr[cch] = 0;
-    outDateTimeStr += dateTimeStr;
-
+    TimeFormatter formatter;
+    formatter.Compile(dateFmt, timeFmt);
+    outDateTimeStr = formatter.Format(timestamp.QuadPart);
     return outDateTimeStr.c_str();
 }
 
 // ------------------------------------------------------------------------------------------------
-// Get File Information for fileId, such as file/folder name
-// Optionally get file/folder length
-// Optionally get/save to a cache.
-bool Ntfs::GetFileInfo(
-        DWORDLONG fileId, 
-        GetInfo getInfo,
-        std::wstring& fullPath, 
-        LARGE_INTEGER& allocatedSize)
+// Volume serial and journal id of open drive.
+bool Ntfs::GetCacheKey(PathStore::CacheKey& key) const
 {
-    if ((getInfo & eCacheIt) != 0)
+    NTFS_VOLUME_DATA_BUFFER volumeData;
+    USN_JOURNAL_DATA journalData;
+    DWORD cb;
+    if (!SysShim::DeviceIoControl(m_volHnd, FSCTL_GET_NTFS_VOLUME_DATA, NULL, 0,
+            &volumeData, sizeof(volumeData), &cb))
     {
-        FileInfoCache::const_iterator iter = m_fileInfoCache.find(fileId);
-        if (iter != m_fileInfoCache.end())
-        {
-            fullPath = iter->second.filePath;
-            allocatedSize = iter->second.allocatedSize;
-            return true;
-        }
+        SaveLastError();
+        return false;
     }
+    if (!QueryJournal(journalData))
+        return false;
 
-    allocatedSize.QuadPart = 0;
-
-    typedef ULONG (__stdcall *pNtCreateFile)
-    (
-        PHANDLE FileHandle,
-        ULONG DesiredAccess,
-        PVOID ObjectAttributes,
-        PVOID IoStatusBlock,
-        PLARGE_INTEGER AllocationSize,
-        ULONG FileAttributes,
-        ULONG ShareAccess,
-        ULONG CreateDisposition,
-        ULONG CreateOptions,
-        PVOID EaBuffer,
-        ULONG EaLength
-    );
-
-    static pNtCreateFile NtCreatefile = (pNtCreateFile)GetProcAddress(GetModuleHandle(L"ntdll.dll"), "NtCreateFile");
+    key.volumeSerial = volumeData.VolumeSerialNumber.QuadPart;
+    key.journalId = journalData.UsnJournalID;
+    key.lastUsn = journalData.FirstUsn;     // oldest record still in journal
+    return true;
+}
 
-    /*
-        UNICODE_STRING 
-            USHORT Length;
-            USHORT MaximumLength;
-            PWSTR  Buffer;
-    */
-    USHORT szFileId = sizeof(fileId);   // ex: 8
-    UNICODE_STRING fidstr = {szFileId, szFileId, (PWSTR) &fileId};
+// ------------------------------------------------------------------------------------------------
+bool Ntfs::LoadPathCache(const wchar_t* cacheFile, USN startUsn)
+{
+    PathStore::CacheKey volumeKey;
+    PathStore::CacheKey savedKey;
+    if (!GetCacheKey(volumeKey))
+        return false;
+    if (!m_pathStore.Load(cacheFile, savedKey))
+    {
+        m_errorMsg = m_pathStore.GetLastErrorMsg();
+        return false;
+    }
 
+    // Renames between saved usn and start of this scan would be missed.
+    USN firstUsn = max(startUsn, volumeKey.lastUsn);
+    if (savedKey.volumeSerial != volumeKey.volumeSerial
+        || savedKey.journalId != volumeKey.journalId
+        || firstUsn > savedKey.lastUsn)
+    {
+        m_pathStore.Clear();
+        m_errorMsg = L"Path cache is of another volume or journal, or out of date";
+        return false;
+    }
+    m_cacheUsn = savedKey.lastUsn;
+    return true;
+}
 
-    /*  OBJECT_ATTRIBUTES
-            ULONG Length;                   // sizeof(OBJECT_ATTRIBUTES)
-            HANDLE RootDirectory;           // m_volHnd.m_handle
-            PUNICODE_STRING ObjectName;     // &fidstr
-            ULONG Attributes;               // OBJ_CASE_INSENSITIVE
-            PVOID SecurityDescriptor;       // NULL
-            PVOID SecurityQualityOfService; // NULL
-    */
-    OBJECT_ATTRIBUTES objAttr = { sizeof(OBJECT_ATTRIBUTES),  m_volHnd.m_handle, &fidstr, OBJ_CASE_INSENSITIVE, NULL, NULL };
- 
+// ------------------------------------------------------------------------------------------------
+bool Ntfs::SavePathCache(const wchar_t* cacheFile)
+{
+    PathStore::CacheKey key;
+    if (!GetCacheKey(key))
+        return false;
 
-    IO_STATUS_BLOCK iosb;
-    ZeroMemory(&iosb, sizeof(iosb));
-    HANDLE fHnd;
-
-    ULONG status = NtCreatefile(
-            &fHnd,                      // FileHandle,
-            FILE_READ_ATTRIBUTES,       // DesiredAccess,
-            &objAttr,                   // ObjectAttributes,
-            &iosb,                      // IoStatusBlock,
-            NULL,                       // Allocated Size,
-            FILE_ATTRIBUTE_NORMAL,      // FileAttributes
-            FILE_SHARE_READ | FILE_SHARE_WRITE,  // ShareAccess,
-            FILE_OPEN,                  // CreateDisposition,   
-            FILE_OPEN_BY_FILE_ID,       // CreateOptions  
-            NULL,                       // EaBuffer,                      
-            0);                         // EaLength                      
-    
-    if (NT_ERROR(status))
+    key.lastUsn = m_nextUsn;
+    if (!m_pathStore.Save(cacheFile, key))
     {
-        // STATUS_INVALID_PARAMETER    0xC000000DL    
-        SaveLastError(status);      
+        m_errorMsg = m_pathStore.GetLastErrorMsg();
         return false;
     }
+    return true;
+}
 
-    struct FileName 
+// ------------------------------------------------------------------------------------------------
+// Directory renamed or moved, old name record finds its cached node and new name record
+// repoints it, so cached paths below it follow.
+// Stored paths are current ones, as file paths are. A rename is only applied to paths older
+// than it: paths loaded from the cache up to the usn it was saved at, paths looked up on the
+// volume during this scan only to renames written after the scan started.
+void Ntfs::RenameCachedDir(const JournalRecord& record)
+{
+    if (record.m_usn < m_cacheUsn)
+        return;
+    bool loadedOnly = (record.m_usn < m_liveUsn);
+    if (loadedOnly && !m_pathStore.HasLoaded())
+        return;
+
+    std::wstring parentPath;
+    if ((record.m_reason & USN_REASON_RENAME_OLD_NAME) != 0)
     {
-        DWORD   length;
-        wchar_t name[MAX_PATH];
-    } fileName;
+        // Old parent is looked up (and cached) when missing. If it can not be found either,
+        // cached paths below the directory can not be told apart, so the cache is dropped.
+        if (!m_pathStore.RenameOld(record.m_fileId, record.m_parentId, record.m_filename, loadedOnly)
+            && !(GetDirInfo(record.m_parentId, parentPath)
+                && m_pathStore.RenameOld(record.m_fileId, record.m_parentId, record.m_filename, loadedOnly)))
+            m_pathStore.Clear();
+        return;
+    }
 
-    bool result;
+    // Cache new parent, then move. Directory and paths below it are dropped if it cannot be moved.
+    GetDirInfo(record.m_parentId, parentPath);
+    m_pathStore.RenameNew(record.m_fileId, record.m_parentId, record.m_filename, loadedOnly);
+}
 
-    
-    if (0 == GetFileInformationByHandleEx(fHnd, FileNameInfo, &fileName, sizeof(fileName)))
+// ------------------------------------------------------------------------------------------------
+// Get File Information for fileId, such as file/folder name
+// Optionally get file/folder length
+// Optionally get/save to a cache.
+bool Ntfs::GetFileInfo(
+        const FileRef& fileId, 
+        GetInfo getInfo,
+        std::wstring& fullPath, 
+        LARGE_INTEGER& allocatedSize)
+{
+    if ((getInfo & eCacheIt) != 0)
     {
-        SaveLastError();
-        result = false;
+        // Only directories are cached, their size is not kept.
+        if (m_pathStore.GetPath(fileId, fullPath))
+        {
+            allocatedSize.QuadPart = 0;
+            return true;
+        }
     }
-    else
-    {
-        fileName.name[fileName.length/sizeof(wchar_t)] = 0;
-        fullPath = fileName.name;
-        result = true;
 
-        if ((getInfo & eGetLength) != 0)
+    // Resolved by PrefetchBatch, from MFT table or volume.
+    if (!m_lookupIndex.empty())
+    {
+        LookupIndex::const_iterator iter = m_lookupIndex.find(fileId);
+        if (iter != m_lookupIndex.end() && (m_lookups[iter->second].getLength || (getInfo & eGetLength) == 0))
         {
-            FILE_STANDARD_INFO standardInfo;
-            if (0 != GetFileInformationByHandleEx(
-                    fHnd, FileStandardInfo, &standardInfo, sizeof(standardInfo)))
+            const LookupPool::Lookup& lookup = m_lookups[iter->second];
+            if (lookup.status != 0)
             {
-                if (fullPath == L"\\car")
-                    std::wcout << "car\n";
-                allocatedSize = standardInfo.AllocationSize;
+                SaveLastError(lookup.status);
+                return false;
             }
-        }
 
-        if ((getInfo & eCacheIt) != 0)
-        {
-            m_fileInfoCache[fileId] = InfoCache(fullPath, allocatedSize);
+            fullPath = lookup.fullPath;
+            allocatedSize = lookup.allocatedSize;
+            if ((getInfo & eCacheIt) != 0)
+                m_pathStore.Add(fileId, fullPath);
+            return true;
         }
     }
 
-    CloseHandle(fHnd);
+    if (m_pMftTable != NULL && m_pMftTable->GetFileInfo(fileId, fullPath, allocatedSize))
+        return true;
+    if (!m_volumeLookup)
+        return false;
 
-    return result;
+    DWORD status = SysShim::LookupFileId(m_volHnd, fileId, (getInfo & eGetLength) != 0, fullPath, allocatedSize);
+    if (status != 0)
+    {
+        // STATUS_INVALID_PARAMETER    0xC000000DL
+        SaveLastError(status);
+        return false;
+    }
+
+    if ((getInfo & eCacheIt) != 0)
+    {
+        m_pathStore.Add(fileId, fullPath);
+    }
+
+    return true;
 }
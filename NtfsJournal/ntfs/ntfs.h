@@ -11,9 +11,16 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 #include "Hnd.h"
 #include "ntfstypes.h"
+#include "FileRef.h"
+#include "JournalSource.h"
+#include "JournalTree.h"
+#include "MftTable.h"
+#include "PathStore.h"
+#include "LookupPool.h"
 
 using namespace std;
 
@@ -31,6 +38,9 @@ public:
     bool IsOpen() const
     { return m_volHnd.IsValid(); }
 
+    HANDLE GetVolumeHandle() const
+    { return m_volHnd; }
+
     void SaveLastError(DWORD error=0) const;
     wstring GetLastErrorMsg() const
     { return m_errorMsg; }
@@ -77,41 +87,120 @@ public:
     // Return true if journal available.
     bool HasJournal() const;
 
+    // Resolve paths from directory tree rebuilt from journal records instead of opening
+    // each file, works offline and for deleted files. Directories older than the journal
+    // are looked up once on the volume, if open.
+    void SetJournalTree(bool useJournalTree)
+    { m_useJournalTree = useJournalTree; }
+
+    // Resolve paths and sizes from table loaded from $MFT, before any volume lookup.
+    // Also enables full paths for offline journals of the same volume.
+    void SetMftTable(const MftTable* pMftTable)
+    { m_pMftTable = pMftTable; }
+
+    // Worker threads of volume lookups, LookupPool::sAutoThreads uses all but one core.
+    void SetLookupThreads(unsigned threadCount)
+    { m_lookupThreads = threadCount; }
+
+    // Persistent directory path cache of open drive. Load keeps the saved cache only if it
+    // is of this volume and journal and no records were skipped since it was saved.
+    bool LoadPathCache(const wchar_t* cacheFile, USN startUsn);
+    bool SavePathCache(const wchar_t* cacheFile);
+    size_t GetPathCacheCount() const
+    { return m_pathStore.GetFileCount(); }
+
+    typedef std::vector<USN_RECORD_EXTENT> ExtentList;
+
     struct JournalRecord
     {
 	    USN				m_usn;
 	    DWORD			m_reason;
-	    DWORDLONG		m_fileId;
+	    FileRef 		m_fileId;
+	    FileRef 		m_parentId;
 	    LARGE_INTEGER	m_timestamp;
         LARGE_INTEGER   m_length;
         DWORD           m_fileAttr;
 	    wstring			m_filename;
+        ExtentList      m_extents;      // changed byte ranges (USN_RECORD_V4)
+    };
+
+    // Raw record in place in the read buffer (or mapped file), valid until the next record.
+    // Ids, reason and attributes are read straight from the raw record, the full record is
+    // only decoded (into a JournalRecord reused for every record) when GetRecord asks for it.
+    class RecordView
+    {
+    public:
+        // pNamed is V2/V3 record naming a V4 range record of the same file, else NULL.
+        RecordView(const USN_RECORD_COMMON_HEADER* pHeader, const USN_RECORD_COMMON_HEADER* pNamed,
+                JournalRecord& record);
+
+        DWORD GetReason() const
+        { return JournalSource::GetRecordReason(m_pHeader); }
+        FileRef GetFileId() const
+        { return JournalSource::GetRecordFileRef(m_pHeader); }
+        FileRef GetParentId() const
+        { return JournalSource::GetRecordParentRef(m_pHeader); }
+        DWORD GetFileAttr() const
+        { return JournalSource::GetRecordAttributes(m_pNamed != NULL ? m_pNamed : m_pHeader); }
+        bool IsDirectory() const
+        { return (GetFileAttr() & FILE_ATTRIBUTE_DIRECTORY) != 0; }
+
+        // Decoded record, m_filename is file name only. Copy it to keep it.
+        const JournalRecord& GetRecord() const
+        { return Decode(); }
+
+    private:
+        friend class Ntfs;
+        JournalRecord& Decode() const;
+
+        const USN_RECORD_COMMON_HEADER* m_pHeader;
+        const USN_RECORD_COMMON_HEADER* m_pNamed;
+        JournalRecord&      m_record;
+        mutable bool        m_isDecoded;
     };
 
     /// Get NTFS USN Journal records which match filter.
     typedef vector<JournalRecord> JournalList;
     bool GetJournal(JournalList& list, USN startUsn=0, DWORD filter=0, bool getFileLength=false, bool getFullPath=true);
 
+    // jRec is reused for the next record, a handler which keeps it keeps a copy.
     typedef void (*HandleRecordCb)(JournalRecord& jRec, void* cbData);
+
+    // Optional test of raw record before its path and length are resolved, return false
+    // to drop record. Cheap filters (time, attributes) then skip the lookups, a filter which
+    // needs no decoded field skips decoding too.
+    typedef bool (*PreFilterCb)(const RecordView& view, void* cbData);
+    void SetPreFilter(PreFilterCb preFilterCb, void* cbData)
+    { m_preFilterCb = preFilterCb; m_preFilterData = cbData; }
+
     bool GetJournal(HandleRecordCb, void* cbData, USN startUsn=0, DWORD filter=0, bool getFileLength = false, bool getFullPath = true);
 
+    /// Get records from any journal source (live, $J file, image, capture).
+    /// Paths and lengths are only resolved if source is this open volume.
+    bool GetJournal(JournalSource& source, JournalList& list, USN startUsn=0, DWORD filter=0, bool getFileLength=false, bool getFullPath=true);
+    bool GetJournal(JournalSource& source, HandleRecordCb, void* cbData, USN startUsn=0, DWORD filter=0, bool getFileLength = false, bool getFullPath = true);
+
+    // Populate record from raw USN record (V2, V3 or V4), m_filename is set to the record's
+    // file name (no path). V4 range records carry no name, only ids, usn, reason and extents are set.
+    static void DecodeRecord(const USN_RECORD_COMMON_HEADER* pHeader, JournalRecord& record);
+
     static const wchar_t* GetReasonString(DWORD dwReason,  std::wstring& outReasonStr);
     static const wchar_t* GetTimestamp(const LARGE_INTEGER& timestamp, std::wstring& outTimeStr,
            const wchar_t* dateFmt = L"dd-MMM-yyyy", const wchar_t* timeFmt = L"HH:mm");
 
 
     enum GetInfo { eGetPath = 0, eGetLength=1, eCacheIt=2 };
-    bool GetFileInfo(DWORDLONG objFRN, GetInfo, std::wstring& fullPath, LARGE_INTEGER& allocatedSize);
+    bool GetFileInfo(const FileRef& objFRN, GetInfo, std::wstring& fullPath, LARGE_INTEGER& allocatedSize);
 
     // Get Directory information, return false if unable to get info.
-    bool GetDirInfo(DWORDLONG dirFRN, std::wstring& fullPath)
+    bool GetDirInfo(const FileRef& dirFRN, std::wstring& fullPath)
     {
         LARGE_INTEGER dummy;
         return GetFileInfo(dirFRN, eCacheIt, fullPath, dummy);
     }
 
     // Get File information, return false if unable to get info.
-    bool GetFileInfo(DWORDLONG fileFRN, std::wstring& fullPath, LARGE_INTEGER& allocatedSize)
+    bool GetFileInfo(const FileRef& fileFRN, std::wstring& fullPath, LARGE_INTEGER& allocatedSize)
     {
         return GetFileInfo(fileFRN, eGetLength, fullPath, allocatedSize);
     }
@@ -121,15 +210,27 @@ public:
 
 private:
     bool QueryJournal(USN_JOURNAL_DATA& usnJournalData) const;
+    bool GetCacheKey(PathStore::CacheKey& key) const;
+    bool GetTreePath(const FileRef& fileId, std::wstring& fullPath);
+    void RenameCachedDir(const JournalRecord& record);
+    void PrefetchBatch(const JournalBatch& batch, bool getFileLength);
+    void AddLookup(const FileRef& fileId, bool getLength);
     bool ReadJournal(
-            USN& usn, 
-            DWORDLONG UsnJournalID, 
+            JournalSource& source,
+            USN startUsn,
+            DWORD filter,
             HandleRecordCb handleCb,
             void* cbData,
-            JournalList* pList, 
-            bool getFileSize,
-            bool getFullPath,
-            unsigned maxRecords = 100);
+            JournalList* pList,
+            bool getFileLength,
+            bool getFullPath);
+    void DecodeBatch(
+            const JournalBatch& batch,
+            HandleRecordCb handleCb,
+            void* cbData,
+            JournalList* pList,
+            bool getFileLength,
+            bool getFullPath);
 
 private:
 	wchar_t					m_drive;
@@ -137,21 +238,28 @@ private:
 	mutable wstring		    m_errorMsg;
 
     // NTFS USN Journal
-	std::vector<byte>	    m_buffer;           
 	DWORD                   m_filter;
     USN                     m_nextUsn;
+    PreFilterCb             m_preFilterCb;
+    void*                   m_preFilterData;
+
+    // Path resolution from journal records (SetJournalTree).
+    bool                    m_useJournalTree;
+    bool                    m_volumeLookup;     // records belong to open volume
+    JournalTree             m_journalTree;
+    const MftTable*         m_pMftTable;
 
     // Improve performance, remember parent path.
-    struct InfoCache
-    {
-        InfoCache() { }
-        InfoCache(const std::wstring& path, LARGE_INTEGER size) :
-            filePath(path), allocatedSize(size) {}
-        std::wstring  filePath;
-        LARGE_INTEGER allocatedSize;
-    };
-    typedef std::map<DWORDLONG, InfoCache> FileInfoCache;
-    FileInfoCache  m_fileInfoCache;
+    PathStore               m_pathStore;
+    USN                     m_cacheUsn;         // loaded cache paths are current up to here
+    USN                     m_liveUsn;          // volume lookups are current from here
+
+    // Unique ids of current batch resolved together on worker threads (PrefetchBatch).
+    typedef std::unordered_map<FileRef, size_t, FileRefHash> LookupIndex;
+    LookupPool              m_lookupPool;
+    unsigned                m_lookupThreads;
+    LookupPool::LookupList  m_lookups;
+    LookupIndex             m_lookupIndex;      // file id -> m_lookups index
 };
 
 
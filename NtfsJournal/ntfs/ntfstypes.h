@@ -34,6 +34,37 @@
 
 #pragma pack(push, curAlignment)
 #pragma pack(1)
+// ------------------------------------------------------------------------------------------------
+// NTFS partition boot sector, first sector of volume.
+struct NTFS_BOOT_SECTOR
+{
+	BYTE		uchJump[3];
+	char		szOemId[8];				// "NTFS    "
+	WORD		wBytesPerSector;
+	BYTE		uchSecPerCluster;		// > 0x80 means 2^(256-value) sectors
+	WORD		wReservedSectors;
+	BYTE		uchZero1[3];
+	WORD		wUnused1;
+	BYTE		uchMediaDesc;
+	WORD		wZero2;
+	WORD		wSecPerTrack;
+	WORD		wNumberOfHeads;
+	DWORD		dwHiddenSectors;
+	DWORD		dwUnused2;
+	DWORD		dwUnused3;
+	LONGLONG	n64TotalSectors;
+	LONGLONG	n64MftLcn;				// Cluster of $MFT
+	LONGLONG	n64MftMirrLcn;			// Cluster of $MFTMirr
+	signed char	chClustersPerMftRec;	// negative means 2^(-value) bytes
+	BYTE		uchPad1[3];
+	signed char	chClustersPerIndexRec;	// negative means 2^(-value) bytes
+	BYTE		uchPad2[3];
+	LONGLONG	n64VolumeSerial;
+	DWORD		dwChecksum;
+	BYTE		uchBootCode[426];
+	WORD		wEndMarker;				// 0xAA55
+};
+
 // ------------------------------------------------------------------------------------------------
 // MFT record header and attribute header  
 struct MFT_FILE_HEADER
@@ -93,6 +124,48 @@ struct	NTFS_ATTRIBUTE
 	}Attr;
 } ;
 
+// ------------------------------------------------------------------------------------------------
+// NTFS_ATTRIBUTE dwType
+enum NTFSAttributeType
+{
+    eAttrStandardInfo   = 0x10,
+    eAttrAttributeList  = 0x20,
+    eAttrFileName       = 0x30,
+    eAttrObjectId       = 0x40,
+    eAttrSecurity       = 0x50,
+    eAttrVolumeName     = 0x60,
+    eAttrVolumeInfo     = 0x70,
+    eAttrData           = 0x80,
+    eAttrIndexRoot      = 0x90,
+    eAttrIndexAllocation= 0xA0,
+    eAttrBitmap         = 0xB0,
+    eAttrReparsePoint   = 0xC0,
+    eAttrEnd            = 0xFFFFFFFF
+};
+
+// Well known MFT record numbers.
+enum MFTRecordNumber
+{
+    eMftRecMft          = 0,    // $MFT
+    eMftRecRoot         = 5,    // Root directory
+    eMftRecExtend       = 11,   // $Extend directory, parent of $UsnJrnl
+    eMftRecFirstUser    = 16
+};
+
+// ------------------------------------------------------------------------------------------------
+// $ATTRIBUTE_LIST entry, locates attributes which live in extension MFT records.
+struct MFT_ATTRIBUTE_LIST_ENTRY
+{
+	DWORD		dwType;
+	WORD		wRecLength;
+	BYTE		uchNameLength;
+	BYTE		uchNameOffset;
+	LONGLONG	n64StartVCN;
+	LONGLONG	n64FileRef;				// Seq[2] MFT record[6] holding attribute
+	WORD		wAttrID;
+								// followed by name
+};
+
 // ------------------------------------------------------------------------------------------------
 //  Attributes 
 struct MFT_STANDARD 
@@ -132,6 +205,7 @@ struct MFT_FILEINFO
 
 const LONGLONG sMaxFileSize = 0xffffffffffff;
 const LONGLONG sParentMask  = 0xffffffffff;
+const LONGLONG sMftRecordMask = 0xffffffffffff;    // File reference is Seq[2] MFT record[6]
 
 // http://inform.pucp.edu.pe/~inf232/Ntfs/ntfs_doc_v0.5/attributes/file_name.html
 enum MFTFileInfoFlags  // dwFlags
@@ -1,14 +1,54 @@
 
 
 #include "ntfsutil.h"
+#include "usnfile.h"
+#include "ntfsimage.h"
+#include "JournalCapture.h"
 #include "localefmt.h"
 
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <string>
 #include <set>
+#include <thread>
+#include <algorithm>
 
 
+// ------------------------------------------------------------------------------------------------
+// Report columns are ignored when output is formatted (-F), only its fields are needed.
+
+void ReportCfg::Prepare() {
+    format.Compile(*this);
+    timeFormatter.Compile(dateFmt.c_str(), timeFmt.c_str());
+
+    if (outputFmt != NULL) {
+        fields = format.GetFields();
+    } else {
+        fields = eFieldPath;
+        if (modifyTime) fields |= eFieldTime;
+        if (size) fields |= eFieldSize;
+        if (reason) fields |= eFieldReason;
+        if (attribute) fields |= eFieldAttribute;
+    }
+
+    // Merged (not detail) output drops repeated deletes by full path, a bare name would also
+    // drop deletes of same named files in other directories.
+    if (!showDetail)
+        fields |= eFieldPath;
+
+    MultiFilter<JRecord>::MatchList& matchList = filter.List();
+    for (unsigned mIdx = 0; mIdx < matchList.size(); mIdx++) {
+        if (matchList[mIdx]->NeedsLength())
+            fields |= eFieldSize;
+        else if (matchList[mIdx]->NeedsPath())
+            fields |= eFieldPath;
+    }
+
+    getFileLength = (fields & eFieldSize) != 0;
+    getFullPath = getFullPath && (fields & eFieldPath) != 0;
+}
+
 namespace Ntfs_Journal {
 // ------------------------------------------------------------------------------------------------
 DWORD ParseReason(const wchar_t* reasons) {
@@ -43,257 +83,545 @@ DWORD ParseReason(const wchar_t* reasons) {
 }
 
 // ------------------------------------------------------------------------------------------------
-// Format output using special meta strings which start with %
-//      %t=time, %s=size, %r=reason
-//      %p=path(dir+filename), %c=drive, %d=directory 
-//      %f=filename (name+ext), %n=name, %e=extension 
-//
-// All formats can include a field width to force padding with spaces.
-//   %20f  will output the filename in 20 characters or more.
-
-void FormatOutput(ReportCfg& cfg, Ntfs::JournalRecord& jRec) {
-    std::wstring dateTimeStr;
-    wchar_t str[100];
-    std::wstring field;
-    std::wstring reasonStr;
-    int pos;
-    DWORD reasonMask = 0xffffffff;
-
-    Ntfs::GetTimestamp(jRec.m_timestamp, dateTimeStr, cfg.dateFmt.c_str(), cfg.timeFmt.c_str());
-
-    for (const wchar_t* pFmt = cfg.outputFmt; *pFmt != 0; pFmt++) {
-#ifdef BACKSLASH_SPECIAL
-        if (*pFmt == '\\') {
-            switch (*++pFmt) {
-            case 'n':
-                std::wcout << "\n";
-                break;
-            case 'r':
-                std::wcout << "\r";
-                break;
-            case 't':
-                std::wcout << "\t";
-                break;
-            case 'x':
-            {
-                wchar_t* endPtr;
-                long n = wcstol(pFmt, &endPtr, 16);
-                if (endPtr != pFmt) {
-                    std::wcout << (char)n;
-                    pFmt = endPtr - 1;
-                }
-            }
-            break;
-            default:
-                std::wcout << *pFmt;
-                break;
-            }
-        } else
-#endif
-            if (*pFmt == cfg.fmtChr) {
-                pFmt++;
-
-                if (*pFmt == NULL)
-                    return;
-                else if (*pFmt == cfg.fmtChr)
-                    std::wcout << cfg.fmtChr;
-                else {
-                    wchar_t* endPtr;
-                    long fieldWidth = wcstol(pFmt, &endPtr, 10);
-                    if (endPtr == pFmt)
-                        fieldWidth = 0;
-                    pFmt = endPtr;
-                    switch (*pFmt) {
-                    case 'a':    // attribute
-                    {
-                        std::wstring attributes;
-                        if (eDirectory & jRec.m_fileAttr) attributes += cfg.dirAttr;
-                        if (eSystem & jRec.m_fileAttr) attributes += L"S";
-                        if (eHidden & jRec.m_fileAttr) attributes += L"H";
-                        if (eReadOnly & jRec.m_fileAttr) attributes += L"R";
-                        std::wcout << std::setw(4) << attributes;
-                    }
-                    break;
-                    case 't':
-                        field = dateTimeStr;
-                        break;
-                    case 's':
-                        std::wcout << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%*lld", fieldWidth, jRec.m_length.QuadPart);
-                        break;
-                    case 'r':    // reason
-                        if ((jRec.m_reason & 0xf00) != 0)
-                            reasonMask &= ~0xff;    // suppress the extend and overwrite if Create or Delete.
-                        field = Ntfs::GetReasonString(jRec.m_reason & reasonMask, reasonStr);
-                        break;
-                    case 'p':    // path = directory + name
-                        field = jRec.m_filename;
-                        break;
-                    case 'd':    // directory
-                        field = jRec.m_filename.substr(0, jRec.m_filename.find_last_of(cfg.slash) + 1);
-                        if (!field.empty())
-                            field.erase(field.end() - 1);
-                        break;
-                    case 'f': // filename = name + ext
-                        field = jRec.m_filename.substr(jRec.m_filename.find_last_of(cfg.slash) + 1);
-                        break;
-                    case 'n': // name
-                        field = jRec.m_filename.substr(jRec.m_filename.find_last_of(cfg.slash) + 1);
-                        field = field.substr(0, field.find_last_of('.'));
-                        break;
-                    case 'e': // ext
-                        pos = (int)jRec.m_filename.find_last_of('.');
-                        field = (pos >= 0 ? jRec.m_filename.substr(pos + 1) : L"");
-                        break;
-                    default:
-                        std::wcout << *pFmt;
-                        continue;
-                    }
-
-                    while ((long)field.length() < fieldWidth)
-                        field += ' ';
-                    std::wcout << field;
-                }
-            } else {
-                std::wcout << *pFmt;
-            }
+// Print one record using report columns or output format.
+
+void ReportRecord(const ReportCfg& cfg, const Ntfs::JournalRecord& jRec, OutputWriter& out) {
+    wchar_t str[30];
+
+    if (cfg.outputFmt != NULL) {
+        cfg.format.Write(cfg, jRec, out);
+        return;
+    }
+
+    if (cfg.usn) {
+        out.WriteNumber(jRec.m_usn, 15);
+        out.Write(cfg.separator);
     }
-#ifndef BACKSLASH_SPECIAL
-    std::wcout << std::endl;
-#endif
+
+    if (cfg.modifyTime) {
+        size_t length;
+        const wchar_t* pTime = cfg.timeFormatter.Format(jRec.m_timestamp.QuadPart, length);
+        out.Write(pTime, length);
+        out.Write(cfg.separator);
+    }
+    if (cfg.size) {
+        LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", jRec.m_length.QuadPart);
+        out.WriteRight(str, wcslen(str), 15);
+        out.Write(cfg.separator);
+    }
+
+    if (cfg.attribute) {
+        OutputFormat::WriteAttributes(cfg, jRec.m_fileAttr, out);
+        out.Write(cfg.separator);
+    }
+
+    int namePos = (int)jRec.m_filename.find_last_of(cfg.slash);
+    const wchar_t* name = ((namePos > 0) ? jRec.m_filename.c_str() + namePos + 1 : jRec.m_filename.c_str());
+    if (cfg.directory)
+        out.Write(jRec.m_filename);
+    else
+        out.Write(name);
+
+    if (cfg.reason) {
+        out.Write(cfg.separator);
+        out.Write(cfg.reasonNames.Get(jRec.m_reason));
+    }
+    out.NewLine();
 }
 
-typedef std::set<size_t> DeletedSet;
-static DeletedSet sDeletedSet;
+// ------------------------------------------------------------------------------------------------
+JournalSession::JournalSession(SourceType sourceType, const wchar_t* path, const ReportCfg& cfg) :
+    m_sourceType(sourceType), m_path(path), m_cfg(cfg), m_hasFilter(false),
+    m_pOutput(NULL), m_outRing(sOutRingSize), m_status(0), m_elapsedMsec(0) {
+    m_cfg.Prepare();
+
+    // Every test first runs on the raw record, only those which need a path run again after lookup.
+    MultiFilter<JRecord>::MatchList& matchList = m_cfg.filter.List();
+    for (unsigned mIdx = 0; mIdx < matchList.size(); mIdx++) {
+        if (matchList[mIdx]->NeedsPath())
+            m_pathFilter.List().push_back(matchList[mIdx]);
+    }
+    m_hasFilter = !matchList.empty();
+    m_ntfs.SetPreFilter(PreFilterCb, this);
+}
 
 // ------------------------------------------------------------------------------------------------
-void HandleRecordCb(Ntfs::JournalRecord& jRec, void* cbData) {
-    ReportCfg& cfg = *(ReportCfg*)cbData;
-    wchar_t str[30];
+// Return true if raw record (time, attributes, file name) may pass filters, run before
+// its path and length are resolved. Record is only decoded if there are filters to run.
+
+bool JournalSession::IsWantedRaw(const Ntfs::RecordView& view) const {
+    // TODO - move this logic into a Filter.
+    if (m_cfg.showFilter != ReportCfg::eShowAll) {
+        bool isDir = (view.GetFileAttr() & eDirectory) != 0;
+        bool showDir = m_cfg.showFilter == ReportCfg::eShowDir;
+        if (showDir != isDir)
+            return false;
+    }
+
+    return !m_hasFilter || m_cfg.filter.IsRawMatch(view.GetRecord(), &m_cfg);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return true if record with resolved path passes remaining filters.
+
+bool JournalSession::IsWanted(const Ntfs::JournalRecord& jRec) const {
+    return !jRec.m_filename.empty() && m_pathFilter.IsMatch(jRec, &m_cfg);
+}
 
-    if (jRec.m_filename.length() != 0 && cfg.filter.IsMatch(jRec, &cfg)) {
-        // TODO - move this logic into a Filter.
-        if (cfg.showFilter != ReportCfg::eShowAll) {
-            bool isDir = (jRec.m_fileAttr & eDirectory) != 0;
-            bool showDir = cfg.showFilter == ReportCfg::eShowDir;
-            if (showDir != isDir)
+// ------------------------------------------------------------------------------------------------
+// Report or collect a wanted record.
+
+void JournalSession::AddRecord(Ntfs::JournalRecord& jRec) {
+    if (!m_cfg.showDetail) {
+        if ((jRec.m_reason & USN_REASON_FILE_DELETE) != 0) {
+            // Delete entries can be duplicates because their fileId will be different even
+            // for the exact same filename.
+            size_t nameHash = std::hash<std::wstring>{}(jRec.m_filename);
+            if (!m_deletedSet.insert(nameHash).second)
                 return;
         }
+    }
 
-        if (!cfg.showDetail) {
-            if ((jRec.m_reason & USN_REASON_FILE_DELETE) != 0) {
-                // Delete entries can be duplicates because their fileId will be different even
-                // for the exact same filename.
-                DeletedSet::iterator iter = sDeletedSet.find(std::hash<std::wstring>{}(jRec.m_filename));
-                if (iter == sDeletedSet.end())
-                    sDeletedSet.insert(std::hash<std::wstring>{}(jRec.m_filename));
-                else
-                    return;
-            }
+    if (m_pOutput != NULL) {
+        // Assign into a record of a batch the writer handed back, reusing its strings.
+        if (m_outBatch.records.size() != sOutBatchRecords)
+            m_outBatch.records.resize(sOutBatchRecords);
+        m_outBatch.records[m_outBatch.count++] = jRec;
+        if (m_outBatch.count == sOutBatchRecords) {
+            m_outRing.Push(m_outBatch);
+            m_outBatch.count = 0;
         }
+    } else {
+        m_records.Add(jRec);
+    }
+}
 
-        if (cfg.outputFmt != NULL) {
-            FormatOutput(cfg, jRec);
-            return;
-        }
+// ------------------------------------------------------------------------------------------------
+// Ring between two pipeline stages. A stage which often waits on a full ring feeds a slower one.
+
+static void LogRingStats(std::wostream& log, const wchar_t* name, const RingStats& stats, size_t capacity) {
+    if (stats.pushCount == 0)
+        return;
 
-        std::wstring dateTimeStr;
-        std::wstring reasonStr;
-
-        if (cfg.usn)
-            std::wcout << std::setw(15) << jRec.m_usn
-            << cfg.separator;
-
-        if (cfg.modifyTime)
-            std::wcout
-            << Ntfs::GetTimestamp(jRec.m_timestamp, dateTimeStr, cfg.dateFmt.c_str(), cfg.timeFmt.c_str())
-            << cfg.separator;
-        if (cfg.size)
-            std::wcout
-            << std::setw(15)
-            << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", jRec.m_length.QuadPart)
-            << cfg.separator;
-
-        if (cfg.attribute) {
-            std::wstring attributes;
-            if (eDirectory & jRec.m_fileAttr) attributes += cfg.dirAttr;
-            if (eSystem & jRec.m_fileAttr) attributes += L"S";
-            if (eHidden & jRec.m_fileAttr) attributes += L"H";
-            if (eReadOnly & jRec.m_fileAttr) attributes += L"R";
-            std::wcout << std::setw(4) << attributes << cfg.separator;
+    wchar_t str[30];
+    log << "--- " << name << " ring " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", stats.pushCount)
+        << " batches, average " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%.1f", (double)stats.occupancySum / stats.pushCount)
+        << " max " << (unsigned)stats.maxOccupancy << " of " << (unsigned)capacity << " queued"
+        << ", producer waited " << stats.fullWaits << ", consumer waited " << stats.emptyWaits << std::endl;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Output stage of streaming session, reports record batches queued by AddRecord.
+
+void JournalSession::WriterLoop() {
+    OutBatch batch;
+    while (m_outRing.Pop(batch)) {
+        for (unsigned idx = 0; idx < batch.count; idx++)
+            ReportRecord(m_cfg, batch.records[idx], *m_pOutput);
+
+        // Output closed or full, later batches are dropped instead of queued.
+        if (m_pOutput->HasFailed()) {
+            m_outRing.Close();
+            break;
         }
+    }
+}
 
-        int namePos = (int)jRec.m_filename.find_last_of(cfg.slash);
-        const wchar_t* name = ((namePos > 0) ? jRec.m_filename.c_str() + namePos + 1 : jRec.m_filename.c_str());
-        if (cfg.directory)
-            std::wcout << jRec.m_filename;
-        else
-            std::wcout << name;
+// ------------------------------------------------------------------------------------------------
+void JournalSession::StartWriter() {
+    m_outBatch.count = 0;
+    m_outRing.Reset();
+    m_writer = std::thread(&JournalSession::WriterLoop, this);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Hand over remaining records and wait until all are reported.
+
+void JournalSession::StopWriter(std::wostream& log) {
+    if (m_outBatch.count != 0)
+        m_outRing.Push(m_outBatch);
+    m_outBatch.count = 0;
+    m_outRing.Close();
+    m_writer.join();
+    LogRingStats(log, L"Output", m_outRing.GetStats(), m_outRing.GetCapacity());
+}
 
-        if (cfg.reason)
-            std::wcout << cfg.separator << Ntfs::GetReasonString(jRec.m_reason, reasonStr);
-        std::wcout << std::endl;
+// ------------------------------------------------------------------------------------------------
+bool JournalSession::PreFilterCb(const Ntfs::RecordView& view, void* cbData) {
+    const JournalSession& session = *(const JournalSession*)cbData;
+    return session.IsWantedRaw(view);
+}
+
+// ------------------------------------------------------------------------------------------------
+void JournalSession::HandleRecordCb(Ntfs::JournalRecord& jRec, void* cbData) {
+    JournalSession& session = *(JournalSession*)cbData;
+    if (session.IsWanted(jRec))
+        session.AddRecord(jRec);
+}
+
+// ------------------------------------------------------------------------------------------------
+void JournalSession::HandleDupRecordCb(Ntfs::JournalRecord& jRec, void* cbData) {
+    JournalSession& session = *(JournalSession*)cbData;
+    if (!session.IsWanted(jRec))
+        return;
+
+    JournalMap::iterator iter = session.m_journalMap.find(jRec.m_fileId);
+
+    if (iter == session.m_journalMap.end()) {
+        session.m_journalMap[jRec.m_fileId] = session.m_dupStore.Add(jRec);
+    } else {
+        // Keep changed byte ranges (V4) of every record.
+        session.m_dupStore.Merge(iter->second, jRec, session.m_cfg.reasonMergeAll);
     }
 }
 
-typedef  std::map<DWORD64, Ntfs::JournalRecord> JournalMap;
-static JournalMap sJournalMap;
+// ------------------------------------------------------------------------------------------------
+// Report records collected by HandleDupRecordCb.
+
+void JournalSession::AddDupRecords() {
+    Ntfs::JournalRecord record;
+    for (JournalMap::iterator iter = m_journalMap.begin();
+        iter != m_journalMap.end();
+        iter++) {
+        m_dupStore.Get(iter->second, record);
+        AddRecord(record);
+    }
+    m_journalMap.clear();
+    m_dupStore.Clear();
+}
 
 // ------------------------------------------------------------------------------------------------
-void HandleDupRecordCb(Ntfs::JournalRecord& jRec, void* cbData) {
-    ReportCfg& cfg = *(ReportCfg*)cbData;
-
-    if (!jRec.m_filename.empty() && cfg.filter.IsMatch(jRec, &cfg)) {
-        // TODO - move this logic into a Filter.
-        if (cfg.showFilter != ReportCfg::eShowAll) {
-            bool isDir = (jRec.m_fileAttr & eDirectory) != 0;
-            bool showDir = cfg.showFilter == ReportCfg::eShowDir;
-            if (showDir != isDir)
-                return;
+static void LogStoreStats(std::wostream& log, const wchar_t* name, const RecordStore& store) {
+    if (store.GetCount() == 0)
+        return;
+
+    const StringArena& names = store.GetNames();
+    wchar_t str[30];
+    log << "--- " << name << " " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", (LONGLONG)store.GetCount())
+        << " records, names " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", (LONGLONG)names.GetUsedBytes() / 1024)
+        << " of " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", (LONGLONG)names.GetReservedBytes() / 1024)
+        << " KB in " << (unsigned)names.GetChunkCount() << " chunks, "
+        << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", (LONGLONG)store.GetMemoryBytes() / 1024) << " KB total" << std::endl;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Decode records of journal source, optionally capturing its raw batches.
+// Return -1 on error or 1 on success.
+
+int JournalSession::ListSource(JournalSource& source, std::wostream& log) {
+    CaptureRecorder recorder(source);
+    JournalSource* pSource = &source;
+    if (m_cfg.captureFile != NULL) {
+        if (!recorder.Open(m_cfg.captureFile)) {
+            log << "Failed to create capture file:" << m_cfg.captureFile << "\nError:" << recorder.GetLastErrorMsg() << std::endl;
+            return -1;
         }
+        pSource = &recorder;
+    }
+
+    bool status;
+    if (m_cfg.showDetail) {
+        status = m_ntfs.GetJournal(*pSource, HandleRecordCb, this, m_cfg.startUsn, m_cfg.reasonFilter, m_cfg.getFileLength, m_cfg.getFullPath);
+    } else {
+        status = m_ntfs.GetJournal(*pSource, HandleDupRecordCb, this, m_cfg.startUsn, m_cfg.reasonFilter, m_cfg.getFileLength, m_cfg.getFullPath);
+        LogStoreStats(log, L"Merged", m_dupStore);
+        AddDupRecords();
+    }
 
-        JournalMap::iterator iter = sJournalMap.find(jRec.m_fileId);
+    wchar_t str[30];
+    log << "--- Read " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", pSource->GetBytesRead());
+    log << " bytes in " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", pSource->GetBatchCount()) << " batches";
+    if (pSource->GetBatchCount() != 0)
+        log << ", " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", pSource->GetBytesRead() / pSource->GetBatchCount())
+            << " bytes per read";
+    if (pSource->GetSkippedBytes() != 0)
+        log << ", skipped " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", pSource->GetSkippedBytes())
+            << " bytes of sparse journal";
+    log << std::endl;
+    if (!source.GetNoteMsg().empty())
+        log << "--- " << source.GetNoteMsg() << std::endl;
+
+    if (!status)
+        log << "Failed reading journal:" << m_path << "\nError:" << m_ntfs.GetLastErrorMsg() << std::endl;
+    return status ? 1 : -1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// One cache file per drive, <pathCacheDir>\PathCache_<drive>.njc
+
+std::wstring JournalSession::GetPathCacheFile() const {
+    std::wstring cacheFile = m_cfg.pathCacheDir;
+    if (!cacheFile.empty() && cacheFile.back() != '\\')
+        cacheFile += '\\';
+    cacheFile += L"PathCache_";
+    cacheFile += towupper(*m_path);
+    cacheFile += L".njc";
+    return cacheFile;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Start with directory paths resolved by previous run, a missing or stale cache starts empty.
+
+void JournalSession::LoadPathCache(const std::wstring& cacheFile, std::wostream& log) {
+    DWORD tick = GetTickCount();
+    if (!m_ntfs.LoadPathCache(cacheFile.c_str(), (USN)m_cfg.startUsn)) {
+        log << "--- Path cache not used:" << cacheFile << " " << m_ntfs.GetLastErrorMsg() << std::endl;
+        return;
+    }
 
-        if (iter == sJournalMap.end()) {
-            sJournalMap[jRec.m_fileId] = jRec;
+    wchar_t str[30];
+    log << "--- Path cache loaded " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", (LONGLONG)m_ntfs.GetPathCacheCount())
+        << " directories in " << (GetTickCount() - tick) / 1000.0 << " seconds" << std::endl;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Open journal source and read it.
+// Offline ($J file, image, capture) records have no volume to resolve their path,
+// only file name is reported.
+
+void JournalSession::Run() {
+    std::wostringstream log;
+    DWORD tick = GetTickCount();
+    m_ntfs.SetJournalTree(m_cfg.journalTree);
+
+    if (m_cfg.mftFile != NULL) {
+        if (!m_mftTable.Load(m_cfg.mftFile)) {
+            log << "Failed to load $MFT:" << m_cfg.mftFile << "\nError:" << m_mftTable.GetLastErrorMsg() << std::endl;
+            m_status = -1;
+            m_elapsedMsec = GetTickCount() - tick;
+            m_log = log.str();
+            return;
+        }
+
+        wchar_t str[30];
+        log << "--- Loaded " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", m_mftTable.GetNamedCount());
+        log << " named of " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", m_mftTable.GetRecordCount())
+            << " MFT records in " << (GetTickCount() - tick) / 1000.0 << " seconds" << std::endl;
+        m_ntfs.SetMftTable(&m_mftTable);
+    }
+
+    if (m_pOutput != NULL)
+        StartWriter();
+
+    switch (m_sourceType) {
+    case eDrive:
+        if (!m_ntfs.OpenDrive(*m_path)) {
+            log << "Failed to open drive:" << m_path << "\nError:" << m_ntfs.GetLastErrorMsg() << std::endl;
+            m_status = -1;
+        } else if (!m_ntfs.HasJournal()) {
+            log << "Journal not available on drive:" << m_path << std::endl;
+            m_status = -1;
         } else {
-            DWORD reason = jRec.m_reason | iter->second.m_reason;
-            sJournalMap[jRec.m_fileId] = jRec;
-            if (cfg.reasonMergeAll)
-                sJournalMap[jRec.m_fileId].m_reason = reason;
+            VolumeSource volumeSource(m_ntfs.GetVolumeHandle(), m_cfg.readSize);
+            // Journal tree mode does not follow renames in the path store, its cache is not kept.
+            if (m_cfg.pathCacheDir != NULL && m_cfg.getFullPath && !m_cfg.journalTree) {
+                std::wstring cacheFile = GetPathCacheFile();
+                LoadPathCache(cacheFile, log);
+                m_status = ListSource(volumeSource, log);
+                if (m_status > 0 && !m_ntfs.SavePathCache(cacheFile.c_str()))
+                    log << "Failed to save path cache:" << cacheFile << "\nError:" << m_ntfs.GetLastErrorMsg() << std::endl;
+            } else {
+                m_status = ListSource(volumeSource, log);
+            }
+            LogRingStats(log, L"Read", volumeSource.GetRingStats(), volumeSource.GetRingCapacity());
+        }
+        break;
+
+    case eJournalFile: {
+        UsnFile usnFile;
+        if (!usnFile.Open(m_path)) {
+            log << "Failed to open journal file:" << m_path << "\nError:" << usnFile.GetLastErrorMsg() << std::endl;
+            m_status = -1;
+        } else {
+            m_status = ListSource(usnFile, log);
         }
     }
+    break;
+
+    case eImage: {
+        // Only allocated journal clusters are read from the image.
+        NtfsImage ntfsImage;
+        if (!ntfsImage.Open(m_path)) {
+            log << "Failed to open NTFS image:" << m_path << "\nError:" << ntfsImage.GetLastErrorMsg() << std::endl;
+            m_status = -1;
+        } else {
+            m_status = ListSource(ntfsImage, log);
+        }
+    }
+    break;
+
+    case eCapture: {
+        CaptureSource captureSource;
+        if (!captureSource.Open(m_path)) {
+            log << "Failed to open capture file:" << m_path << "\nError:" << captureSource.GetLastErrorMsg() << std::endl;
+            m_status = -1;
+        } else {
+            m_status = ListSource(captureSource, log);
+        }
+    }
+    break;
+    }
+
+    if (m_pOutput != NULL)
+        StopWriter(log);
+    else
+        LogStoreStats(log, L"Kept", m_records);
+    m_elapsedMsec = GetTickCount() - tick;
+    m_log = log.str();
+}
+
+// ------------------------------------------------------------------------------------------------
+static const wchar_t* GetSessionTitle(const JournalSession& session) {
+    switch (session.GetSourceType()) {
+    case JournalSession::eJournalFile:
+        return L"Journal file ";
+    case JournalSession::eImage:
+        return L"Journal in image ";
+    case JournalSession::eCapture:
+        return L"Journal capture ";
+    default:
+        return L"Journal for ";
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Distinct reason combinations of reported records, most frequent first.
+
+static void ReportReasons(const ReasonNames& reasonNames) {
+    if (reasonNames.GetCount() == 0)
+        return;
+
+    ReasonNames::EntryList entries;
+    reasonNames.GetEntries(entries);
+    std::wcerr << L"--- Reasons " << (unsigned)entries.size() << L" distinct combinations\n";
+
+    wchar_t str[30];
+    const size_t sMaxShown = 10;
+    for (size_t idx = 0; idx < entries.size() && idx < sMaxShown; idx++)
+        std::wcerr << L"    " << std::setw(15) << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", entries[idx]->count)
+            << L" " << entries[idx]->name << std::endl;
+    if (entries.size() > sMaxShown)
+        std::wcerr << L"    ...\n";
+}
+
+// ------------------------------------------------------------------------------------------------
+// Session log goes to stderr, flush records reported before it so console shows them in order.
+
+static void ReportSessionLog(const JournalSession& session, OutputWriter& out) {
+    out.Flush();
+    std::wcerr << session.GetLog();
+    ReportReasons(session.GetCfg().reasonNames);
+    std::wcerr << L"--- " << session.GetElapsedMsec() / 1000.0 << L" seconds\n";
 }
 
 // ------------------------------------------------------------------------------------------------
-// List NTFS journal, return -1 on error or 1 on success.  
+// Return false if output could not be written.
 
-int ListJournal(const wchar_t* drivePath, Ntfs& ntfs, ReportCfg& cfg) {
-    if (!ntfs.OpenDrive(*drivePath)) {
-        std::wcerr << "Failed to open drive:" << drivePath << "\nError:" << ntfs.GetLastErrorMsg() << std::endl;
-        return -1;
+static bool ReportOutputStats(OutputWriter& out) {
+    out.Flush();
+    if (out.HasFailed()) {
+        std::wcerr << L"Failed writing output\nError:" << out.GetLastErrorMsg() << std::endl;
+        return false;
     }
+    if (out.GetWriteCount() == 0)
+        return true;
 
-    if (!ntfs.HasJournal()) {
-        std::wcerr << "Journal not available on drive:" << drivePath << std::endl;
-        return -1;
+    wchar_t str[30];
+    std::wcerr << L"--- Output " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", out.GetBytesWritten())
+        << L" bytes in " << LocaleFmt::snprintf(str, ARRAYSIZE(str), L"%lld", out.GetWriteCount()) << L" writes"
+        << (out.IsConsole() ? L" to console" : L"") << std::endl;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+struct MergeItem {
+    JournalSession*     pSession;
+    size_t              index;          // of session record
+    LONGLONG            timestamp;
+
+    bool operator<(const MergeItem& rhs) const
+    { return timestamp < rhs.timestamp; }
+};
+
+// ------------------------------------------------------------------------------------------------
+// Run sessions in parallel, total time is that of slowest journal.
+// Output stage reports sessions one after the other, or all records merged by timestamp.
+
+int RunSessions(SessionList& sessions, bool timeOrder) {
+    int status = 1;
+
+    OutputWriter out;
+    out.Open(GetStdHandle(STD_OUTPUT_HANDLE),
+        sessions[0]->GetCfg().outputUtf16 ? OutputWriter::eUtf16 : OutputWriter::eUtf8);
+
+    if (sessions.size() == 1 && !timeOrder) {
+        // Single journal, report records as they are read.
+        JournalSession& session = *sessions[0];
+        std::wcerr << L"--- " << GetSessionTitle(session) << session.GetPath() << std::endl;
+        session.SetStreaming(&out);
+        session.Run();
+        ReportSessionLog(session, out);
+        out.NewLine();
+        bool outputOk = ReportOutputStats(out);
+        return (session.GetStatus() < 0 || !outputOk) ? -1 : 1;
     }
 
-    bool status;
-    if (cfg.showDetail) {
-        status = ntfs.GetJournal(HandleRecordCb, &cfg, cfg.startUsn, cfg.reasonFilter, cfg.getFileLength, cfg.getFullPath);
-    } else {
-        status = ntfs.GetJournal(HandleDupRecordCb, &cfg, cfg.startUsn, cfg.reasonFilter, cfg.getFileLength, cfg.getFullPath);
-        for (JournalMap::iterator iter = sJournalMap.begin();
-            iter != sJournalMap.end();
-            iter++) {
-            HandleRecordCb(iter->second, &cfg);
+    DWORD tick = GetTickCount();
+    std::vector<std::thread> threads;
+    unsigned lookupThreads = LookupPool::GetThreadBudget((unsigned)sessions.size());
+    for (unsigned idx = 0; idx < sessions.size(); idx++) {
+        std::wcerr << L"--- " << GetSessionTitle(*sessions[idx]) << sessions[idx]->GetPath() << std::endl;
+        sessions[idx]->SetLookupThreads(lookupThreads);
+        threads.push_back(std::thread(&JournalSession::Run, sessions[idx]));
+    }
+    for (unsigned idx = 0; idx < threads.size(); idx++)
+        threads[idx].join();
+
+    if (timeOrder) {
+        // Stable sort keeps journal (USN) order of records with equal timestamps.
+        std::vector<MergeItem> merged;
+        for (unsigned idx = 0; idx < sessions.size(); idx++) {
+            const RecordStore& records = sessions[idx]->GetRecords();
+            for (size_t recIdx = 0; recIdx < records.GetCount(); recIdx++) {
+                MergeItem item = { sessions[idx], recIdx, records.GetTimestamp(recIdx).QuadPart };
+                merged.push_back(item);
+            }
+        }
+        std::stable_sort(merged.begin(), merged.end());
+
+        Ntfs::JournalRecord record;
+        for (unsigned idx = 0; idx < merged.size(); idx++) {
+            merged[idx].pSession->GetRecords().Get(merged[idx].index, record);
+            ReportRecord(merged[idx].pSession->GetCfg(), record, out);
         }
+        out.NewLine();
     }
 
-    return status ? 1 : -1;
-}
+    for (unsigned idx = 0; idx < sessions.size(); idx++) {
+        JournalSession& session = *sessions[idx];
+        out.Flush();
+        std::wcerr << L"--- " << GetSessionTitle(session) << session.GetPath() << std::endl;
+        if (!timeOrder) {
+            RecordStore& records = session.GetRecords();
+            Ntfs::JournalRecord record;
+            for (size_t recIdx = 0; recIdx < records.GetCount(); recIdx++) {
+                records.Get(recIdx, record);
+                ReportRecord(session.GetCfg(), record, out);
+            }
+            out.NewLine();
+        }
 
+        ReportSessionLog(session, out);
+        session.GetRecords().Clear();
+        if (session.GetStatus() < 0)
+            status = -1;
+    }
 
+    if (!ReportOutputStats(out))
+        status = -1;
+    std::wcerr << L"--- Total " << (GetTickCount() - tick) / 1000.0 << L" seconds\n";
+    return status;
+}
 
 const wchar_t sRegKeyStr[] = L"SOFTWARE\\NtfsJournal";
 wchar_t gRegName[] = L"NextUsn-X";
@@ -3,6 +3,28 @@
 
 #include "ntfs.h"
 #include "fsfilter.h"
+#include "SpscRing.h"
+#include "RecordStore.h"
+#include "OutputWriter.h"
+#include "OutputFormat.h"
+#include "TimeFormatter.h"
+#include "ReasonNames.h"
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <thread>
+#include <vector>
+
+// Record fields a report needs (columns, -F format and filters). Lookups and
+// formatting of fields not asked for are skipped.
+enum ReportField {
+    eFieldTime      = 0x01,
+    eFieldSize      = 0x02,
+    eFieldReason    = 0x04,
+    eFieldAttribute = 0x08,
+    eFieldPath      = 0x10
+};
 
 struct ReportCfg {
     ReportCfg() :
@@ -12,10 +34,11 @@ struct ReportCfg {
         directory(true), name(true),
         reason(false), reasonMergeAll(false),
         getFileLength(false),
-        getFullPath(true),
+        getFullPath(true), journalTree(false),
         slash('\\'), fmtChr('%'), dirAttr(L"D"), separator(L" "),
         dateFmt(L"dd-MMM-yyyy"), timeFmt(L"HH:mm"),
-        outputFmt(NULL) { }
+        outputFmt(NULL), captureFile(NULL), mftFile(NULL), pathCacheDir(NULL),
+        readSize(0), outputUtf16(false), fields(0) { }
 
     MultiFilter<JRecord> filter;
     DWORD64         startUsn;
@@ -36,8 +59,9 @@ struct ReportCfg {
     bool            reason;
     bool            reasonMergeAll;    // true = merge reasons when removing duplicates.
                                        // false = keep last reason (newest)
-    bool            getFileLength;     // true get file length (expensive time to get value)
+    bool            getFileLength;     // true get file length (expensive time to get value), see Prepare
     bool            getFullPath;       // true get file/dir full path (expensive time to get value)
+    bool            journalTree;       // true build full path from journal records (fast, offline)
 
     // Output controls
     wchar_t         slash;
@@ -47,15 +71,134 @@ struct ReportCfg {
     const wchar_t*  separator;
     std::wstring    dateFmt;
     std::wstring    timeFmt;
+    mutable TimeFormatter timeFormatter; // dateFmt and timeFmt compiled, output stage only
+    mutable ReasonNames reasonNames;   // reason strings reported, output stage only
     const wchar_t*  outputFmt;
+    OutputFormat    format;            // outputFmt compiled, see Prepare
+    const wchar_t*  captureFile;       // write raw journal batches to file
+    const wchar_t*  mftFile;           // $MFT file or image, path table of scanned volume
+    const wchar_t*  pathCacheDir;      // directory of path caches kept between runs
+    DWORD           readSize;          // drive journal bytes per read, 0 = adaptive
+    bool            outputUtf16;       // redirected output as UTF-16LE, default UTF-8
+    DWORD           fields;            // ReportField bits, see Prepare
+
+    // Call once options and filters are set (fmtChr may follow outputFmt), each session
+    // does for its copy. Compile outputFmt and derive fields, getFileLength and
+    // getFullPath from what the report and filters use.
+    void Prepare();
 };
 
 namespace Ntfs_Journal {
     DWORD ParseReason(const wchar_t* reasons);
 
-    int ListJournal(const wchar_t* drivePath, Ntfs& ntfs, ReportCfg& cfg);
+    // One journal scan (drive, $J file, image or capture) with its own copy of the report
+    // settings, dedup state, path cache and checkpoint, so sessions can run in parallel.
+    class JournalSession {
+    public:
+        enum SourceType { eDrive, eJournalFile, eImage, eCapture };
+
+        JournalSession(SourceType sourceType, const wchar_t* path, const ReportCfg& cfg);
+
+        // Read journal and collect records to report, safe to run concurrently with other sessions.
+        void Run();
+
+        // Report records to output as they are read instead of collecting them. A writer
+        // thread formats them, so output overlaps reading and decoding the journal.
+        void SetStreaming(OutputWriter* pOutput)
+        { m_pOutput = pOutput; }
+
+        // Volume lookup threads of this session, parallel sessions share the cores.
+        void SetLookupThreads(unsigned threadCount)
+        { m_ntfs.SetLookupThreads(threadCount); }
+
+        // -1 on error, 1 on success, 0 if not run.
+        int GetStatus() const
+        { return m_status; }
+
+        SourceType GetSourceType() const
+        { return m_sourceType; }
+        const wchar_t* GetPath() const
+        { return m_path; }
+        const ReportCfg& GetCfg() const
+        { return m_cfg; }
+
+        // Checkpoint, next USN of journal after scan.
+        USN GetNextUsn() const
+        { return m_ntfs.GetNextUsn(); }
+        bool IsOpen() const
+        { return m_ntfs.IsOpen(); }
+        wchar_t GetDrive() const
+        { return m_ntfs.GetDrive(); }
+
+        // Progress and error messages, reported by output stage.
+        std::wstring GetLog() const
+        { return m_log; }
+        DWORD GetElapsedMsec() const
+        { return m_elapsedMsec; }
+
+        RecordStore& GetRecords()
+        { return m_records; }
+
+    private:
+        JournalSession(const JournalSession&);
+        JournalSession& operator=(const JournalSession&);
+
+        int ListSource(JournalSource& source, std::wostream& log);
+        std::wstring GetPathCacheFile() const;
+        void LoadPathCache(const std::wstring& cacheFile, std::wostream& log);
+        bool IsWantedRaw(const Ntfs::RecordView& view) const;
+        bool IsWanted(const Ntfs::JournalRecord& jRec) const;
+        void AddRecord(Ntfs::JournalRecord& jRec);
+        void AddDupRecords();
+        void StartWriter();
+        void StopWriter(std::wostream& log);
+        void WriterLoop();
+
+        static bool PreFilterCb(const Ntfs::RecordView& view, void* cbData);
+        static void HandleRecordCb(Ntfs::JournalRecord& jRec, void* cbData);
+        static void HandleDupRecordCb(Ntfs::JournalRecord& jRec, void* cbData);
+
+        typedef std::set<size_t> DeletedSet;
+        typedef std::map<FileRef, size_t> JournalMap;      // file id -> m_dupStore index
+        // Streamed records, kept allocated between batches so their strings keep capacity.
+        struct OutBatch {
+            OutBatch() : count(0) { }
+            Ntfs::JournalList   records;
+            size_t              count;
+        };
+        typedef SpscRing<OutBatch> RecordRing;
+
+        static const unsigned sOutBatchRecords = 256;
+        static const unsigned sOutRingSize = 8;
+
+        SourceType          m_sourceType;
+        const wchar_t*      m_path;
+        ReportCfg           m_cfg;
+        MultiFilter<JRecord> m_pathFilter;      // tests of path or length
+        bool                m_hasFilter;
+        Ntfs                m_ntfs;
+        MftTable            m_mftTable;
+        JournalMap          m_journalMap;
+        RecordStore         m_dupStore;         // newest record of each file (HandleDupRecordCb)
+        DeletedSet          m_deletedSet;
+        RecordStore         m_records;          // collected for output stage
+        OutputWriter*       m_pOutput;          // streaming output, NULL collects records
+        OutBatch            m_outBatch;         // streamed records not yet handed to writer
+        RecordRing          m_outRing;
+        std::thread         m_writer;
+        int                 m_status;
+        std::wstring        m_log;
+        DWORD               m_elapsedMsec;
+    };
+    typedef std::vector<JournalSession*> SessionList;
+
+    // Run sessions in parallel, then report their records in session order or
+    // merged by timestamp. Return -1 if any session failed, else 1.
+    int RunSessions(SessionList& sessions, bool timeOrder);
+
+    void ReportRecord(const ReportCfg& cfg, const Ntfs::JournalRecord& jRec, OutputWriter& out);
 
     bool ReadRegistry(const wchar_t* keyStr, std::wstring& valueStr);
     bool ReadRegistry(wchar_t drive, DWORD64& nextUsn);
     void WriteRegistry(wchar_t drive, DWORD64 nextUsn);
-}
\ No newline at end of file
+}